@@ -0,0 +1,174 @@
+/*
+* thug_demod_bench: real-time factor of morse_demodulator per channel, written as JSON.
+*
+*	thug_demod_bench [--channels N] [--seconds SECONDS] [--noise SIGMA] [--block SAMPLES] [--out PATH]
+*
+* Every channel is its own synthesized signal: a text repeated for at least --seconds, at a different speed and tone for each channel,
+* with gaussian noise added. The channels are pushed block by block in turn, as a receiver that decodes several signals at once would,
+* and the time spent in each channel's push calls is measured. The real-time factor is seconds of audio per second of processing:
+* a value of 100 means one core could keep up with 100 such channels.
+*/
+#include "thug.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct bench_options
+	{
+		size_t channels = 8;
+		double seconds = 60.0;
+		float noise = 0.3f;
+		size_t block = 1024;
+		std::string out;
+	};
+
+	struct channel
+	{
+		double wpm = 0.0;
+		double tone_frequency = 0.0;
+		std::vector<float> audio;
+		std::string morse;
+		double seconds = 0.0; // spent in push and finish
+		double audio_seconds = 0.0;
+	};
+
+	// The text repeated until it keys for at least seconds at wpm, with a second of silence before and after.
+	channel make_channel(const bench_options& options, size_t index)
+	{
+		static const double speeds[] = { 12.0, 18.0, 20.0, 25.0, 30.0, 35.0 };
+		channel result;
+		result.wpm = speeds[index % (sizeof(speeds) / sizeof(speeds[0]))];
+		result.tone_frequency = 500.0 + 50.0 * static_cast<double>(index % 12);
+
+		thug::synthesis_options synthesis;
+		synthesis.wpm = result.wpm;
+		synthesis.tone_frequency = result.tone_frequency;
+		thug::morse_synthesizer synthesizer(synthesis);
+		const std::string morse = thug::morse_converter().encode("cq cq de dl1abc the quick brown fox jumps over the lazy dog 0123456789 ");
+		const size_t total = static_cast<size_t>((options.seconds + 1.0) * synthesis.sample_rate);
+
+		result.audio.assign(static_cast<size_t>(synthesis.sample_rate), 0.0f);
+		std::vector<float> buffer(4096);
+		while (result.audio.size() < total)
+		{
+			synthesizer.push(morse);
+			size_t count = 0;
+			while ((count = synthesizer.render(buffer.data(), buffer.size())) > 0)
+				result.audio.insert(result.audio.end(), buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(count));
+		}
+		result.audio.resize(result.audio.size() + static_cast<size_t>(synthesis.sample_rate), 0.0f);
+
+		std::mt19937 rng(static_cast<uint32_t>(index + 1));
+		std::normal_distribution<float> gaussian(0.0f, options.noise);
+		if (options.noise > 0.0f)
+		{
+			for (float& sample : result.audio)
+				sample += gaussian(rng);
+		}
+		return result;
+	}
+
+	bool parse_count(const char* arg, size_t& value)
+	{
+		char* end = nullptr;
+		unsigned long long parsed = std::strtoull(arg, &end, 10);
+		value = static_cast<size_t>(parsed);
+		return end != arg && *end == '\0' && parsed != 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	bench_options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		bool ok = has_value;
+		if (arg == "--channels" && has_value)
+			ok = parse_count(argv[++i], options.channels);
+		else if (arg == "--seconds" && has_value)
+			ok = (options.seconds = std::atof(argv[++i])) > 0.0;
+		else if (arg == "--noise" && has_value)
+			ok = (options.noise = static_cast<float>(std::atof(argv[++i]))) >= 0.0f;
+		else if (arg == "--block" && has_value)
+			ok = parse_count(argv[++i], options.block);
+		else if (arg == "--out" && has_value)
+			options.out = argv[++i];
+		else
+			ok = false;
+
+		if (!ok)
+		{
+			std::cerr << "usage: thug_demod_bench [--channels N] [--seconds SECONDS] [--noise SIGMA] [--block SAMPLES] [--out PATH]\n";
+			return 2;
+		}
+	}
+
+	std::vector<channel> channels;
+	std::vector<thug::morse_demodulator> demodulators;
+	channels.reserve(options.channels);
+	demodulators.reserve(options.channels);
+	for (size_t i = 0; i < options.channels; ++i)
+	{
+		channels.push_back(make_channel(options, i));
+		thug::demodulation_options demodulation;
+		demodulation.tone_frequency = channels[i].tone_frequency;
+		std::string* morse = &channels[i].morse;
+		demodulators.emplace_back(demodulation, thug::default_format, [morse](std::string_view out) { *morse += out; });
+	}
+
+	using clock = std::chrono::steady_clock;
+	size_t samples = 0;
+	for (const channel& c : channels)
+		samples = std::max(samples, c.audio.size());
+	for (size_t offset = 0; offset < samples; offset += options.block)
+	{
+		for (size_t i = 0; i < channels.size(); ++i)
+		{
+			if (offset >= channels[i].audio.size())
+				continue;
+			size_t count = std::min(options.block, channels[i].audio.size() - offset);
+			auto start = clock::now();
+			demodulators[i].push(channels[i].audio.data() + offset, count);
+			channels[i].seconds += std::chrono::duration<double>(clock::now() - start).count();
+		}
+	}
+
+	std::ofstream file;
+	if (!options.out.empty())
+		file.open(options.out);
+	std::ostream& os = options.out.empty() ? std::cout : file;
+	double total_seconds = 0.0, total_audio_seconds = 0.0;
+	os << "{\n  \"library\": \"thug\",\n  \"noise\": " << options.noise
+		<< ",\n  \"block\": " << options.block << ",\n  \"channels\": [\n";
+	for (size_t i = 0; i < channels.size(); ++i)
+	{
+		auto start = clock::now();
+		demodulators[i].finish();
+		channels[i].seconds += std::chrono::duration<double>(clock::now() - start).count();
+		channels[i].audio_seconds = static_cast<double>(channels[i].audio.size()) / thug::demodulation_options().sample_rate;
+		total_seconds += channels[i].seconds;
+		total_audio_seconds += channels[i].audio_seconds;
+
+		double rtf = channels[i].seconds > 0.0 ? channels[i].audio_seconds / channels[i].seconds : 0.0;
+		std::fprintf(stderr, "channel %3zu  %5.1f wpm  %6.0f Hz  estimated %5.1f wpm  %8.0fx real time  %6zu letters\n", i, channels[i].wpm,
+			channels[i].tone_frequency, demodulators[i].wpm(), rtf, thug::morse_converter().decode(channels[i].morse).size());
+		os << "    { \"channel\": " << i << ", \"wpm\": " << channels[i].wpm << ", \"tone_frequency\": " << channels[i].tone_frequency
+			<< ", \"estimated_wpm\": " << demodulators[i].wpm() << ", \"audio_seconds\": " << channels[i].audio_seconds
+			<< ", \"seconds\": " << channels[i].seconds << ", \"real_time_factor\": " << rtf
+			<< " }" << (i + 1 < channels.size() ? "," : "") << "\n";
+	}
+	double rtf_per_channel = total_seconds > 0.0 ? total_audio_seconds / total_seconds : 0.0;
+	std::fprintf(stderr, "%zu channels: %.0fx real time per channel\n", channels.size(), rtf_per_channel);
+	os << "  ],\n  \"real_time_factor_per_channel\": " << rtf_per_channel << "\n}\n";
+	return os ? 0 : 1;
+}
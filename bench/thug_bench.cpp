@@ -0,0 +1,388 @@
+/*
+* thug_bench: throughput and allocation counts of the public entry points of thug.h, written as JSON.
+*
+*	thug_bench [--min-size N] [--max-size N] [--file-max-size N] [--baseline-max-size N] [--min-time SECONDS] [--filter TEXT] [--out PATH]
+*
+* Corpora are generated text of 16 bytes up to --max-size (1 GiB by default) in steps of 4x, in the default format and a custom one.
+* Every call is repeated until --min-time has passed. Inputs that take morse are also run with 0.1%, 1% and 5% of their bytes corrupted.
+* Allocations are counted by replacing the global operator new, and reported per call. A 1 GiB corpus needs about 12 GiB of memory.
+* decode is also run through a copy of the original lookup, which scanned the whole key table for every token, up to --baseline-max-size
+* (64 MiB by default), and the JSON reports how much faster the packed-code index is on each corpus.
+*/
+#include "thug.h"
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	std::atomic<uint64_t> g_allocations{ 0 };
+}
+
+void* operator new(std::size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size != 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size != 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+namespace
+{
+	struct bench_options
+	{
+		uint64_t min_size = 16;
+		uint64_t max_size = uint64_t(1) << 30;
+		uint64_t file_max_size = uint64_t(1) << 30;
+		uint64_t baseline_max_size = uint64_t(1) << 26;
+		double min_time = 0.25;
+		std::string filter;
+		std::string out;
+	};
+
+	struct bench_result
+	{
+		std::string name;
+		std::string format;
+		uint64_t size = 0; // bytes of the text the input was made from
+		uint64_t input_bytes = 0;
+		double corruption = 0.0;
+		uint64_t iterations = 0;
+		double seconds_per_call = 0.0;
+		double allocations_per_call = 0.0;
+		uint64_t tokens = 0;
+	};
+
+	// Keeps results alive so the calls are not optimized away.
+	volatile size_t g_sink = 0;
+
+	const char* const repair_mode_names[] = { "remove_incorrect_letter", "remove_incorrect_key", "try_replacing_with_short_press",
+		"try_replacing_with_long_press", "try_ordered_repair_list_one_by_one", "try_nearest_valid_code" };
+
+	// Words, numbers and some punctuation, cut to exactly size bytes. The same seed gives the same text on every run.
+	std::string make_text(uint64_t size)
+	{
+		static const char* const words[] = { "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "cq", "de", "station", "signal",
+			"report", "weather", "antenna", "power", "copy", "thanks", "name", "qth", "rig", "73", "599", "5nn", "k", "?", "de", "and", "is", "a" };
+		std::mt19937 rng(12345);
+		std::string text;
+		text.reserve(static_cast<size_t>(size) + 16);
+		while (text.size() < size)
+		{
+			text += words[rng() % (sizeof(words) / sizeof(words[0]))];
+			text += rng() % 16 == 0 ? ". " : " ";
+		}
+		text.resize(static_cast<size_t>(size));
+		return text;
+	}
+
+	// Replaces about rate of the bytes of morse with a foreign byte or the other press key.
+	std::string corrupt(std::string morse, double rate, thug::morse_format fmt)
+	{
+		if (rate <= 0.0)
+			return morse;
+		std::mt19937 rng(54321);
+		std::uniform_real_distribution<double> chance(0.0, 1.0);
+		for (char& c : morse)
+		{
+			if (chance(rng) >= rate)
+				continue;
+			if (rng() % 2 == 0)
+				c = 'x';
+			else if (c == fmt.short_press)
+				c = fmt.long_press;
+			else if (c == fmt.long_press)
+				c = fmt.short_press;
+		}
+		return morse;
+	}
+
+	/*
+	* @brief decode as it was before the packed-code index: the morse is split into a vector of strings, and every token is compared
+	* with the code of every letter in turn. Kept here only to measure the index against.
+	*/
+	class baseline_decoder
+	{
+	public:
+		explicit baseline_decoder(const thug::morse_converter& converter)
+		{
+			for (int c = 0; c < 256; ++c)
+			{
+				std::string code = converter.encode(std::string(1, static_cast<char>(c)));
+				if (!code.empty() && static_cast<char>(c) == static_cast<char>(std::tolower(c)))
+					m_keys[static_cast<char>(c)] = code;
+			}
+		}
+
+		std::string decode(const std::string& morse) const
+		{
+			std::stringstream ss;
+			auto parsed_text = separate_string(morse);
+			if (parsed_text.size() == 0)
+				return std::string{};
+			for (auto& item : parsed_text)
+			{
+				for (auto& [key, value] : m_keys)
+				{
+					if (value == item)
+					{
+						ss << key;
+						break;
+					}
+				}
+			}
+			return ss.str();
+		}
+	private:
+		static std::vector<std::string> separate_string(const std::string& source)
+		{
+			std::string temp = "";
+			std::vector<std::string> result;
+
+			for (size_t i = 0; i < source.size(); i++)
+			{
+				if (!::isspace(source[i]))
+				{
+					temp += source[i];
+				}
+				else
+				{
+					if (temp.empty())
+						continue;
+					result.push_back(temp);
+					temp = "";
+				}
+			}
+			if (!temp.empty())
+				result.push_back(temp);
+
+			return result;
+		}
+
+		std::unordered_map<char, std::string> m_keys;
+	};
+
+	class bench_runner
+	{
+	public:
+		explicit bench_runner(const bench_options& options) : m_options(options) {}
+
+		// Calls fn until min_time has passed, at least once after a warm-up call, and records the time and allocations per call.
+		template <typename Fn>
+		void run(const std::string& name, const std::string& format, uint64_t size, uint64_t input_bytes, double corruption, uint64_t tokens, Fn&& fn)
+		{
+			if (!m_options.filter.empty() && name.find(m_options.filter) == std::string::npos)
+				return;
+
+			g_sink = g_sink + fn();
+			uint64_t iterations = 0;
+			uint64_t allocations = g_allocations.load(std::memory_order_relaxed);
+			auto start = std::chrono::steady_clock::now();
+			double elapsed = 0.0;
+			do
+			{
+				g_sink = g_sink + fn();
+				++iterations;
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			} while (elapsed < m_options.min_time);
+			allocations = g_allocations.load(std::memory_order_relaxed) - allocations;
+
+			bench_result result;
+			result.name = name;
+			result.format = format;
+			result.size = size;
+			result.input_bytes = input_bytes;
+			result.corruption = corruption;
+			result.iterations = iterations;
+			result.seconds_per_call = elapsed / static_cast<double>(iterations);
+			result.allocations_per_call = static_cast<double>(allocations) / static_cast<double>(iterations);
+			result.tokens = tokens;
+			std::fprintf(stderr, "%-44s %-8s %11llu B  corrupt %5.3f  %10.2f MB/s  %12.0f tokens/s  %8.2f allocs/call\n",
+				name.c_str(), format.c_str(), static_cast<unsigned long long>(size), corruption, mb_per_s(result), tokens_per_s(result), result.allocations_per_call);
+			m_results.push_back(std::move(result));
+		}
+
+		static double mb_per_s(const bench_result& result)
+		{
+			return result.seconds_per_call > 0.0 ? static_cast<double>(result.input_bytes) / result.seconds_per_call / 1e6 : 0.0;
+		}
+
+		static double tokens_per_s(const bench_result& result)
+		{
+			return result.seconds_per_call > 0.0 ? static_cast<double>(result.tokens) / result.seconds_per_call : 0.0;
+		}
+
+		void write_json(std::ostream& os) const
+		{
+			os << "{\n  \"library\": \"thug\",\n  \"min_time\": " << m_options.min_time << ",\n  \"results\": [\n";
+			for (size_t i = 0; i < m_results.size(); ++i)
+			{
+				const auto& r = m_results[i];
+				os << "    { \"name\": \"" << r.name << "\", \"format\": \"" << r.format << "\", \"size\": " << r.size
+					<< ", \"input_bytes\": " << r.input_bytes << ", \"corruption\": " << r.corruption << ", \"iterations\": " << r.iterations
+					<< ", \"seconds_per_call\": " << r.seconds_per_call << ", \"mb_per_s\": " << mb_per_s(r) << ", \"tokens_per_s\": " << tokens_per_s(r)
+					<< ", \"allocations_per_call\": " << r.allocations_per_call << " }" << (i + 1 < m_results.size() ? "," : "") << "\n";
+			}
+			os << "  ],\n  \"decode_speedup_over_baseline\": [\n";
+			bool first = true;
+			for (const auto& baseline : m_results)
+			{
+				if (baseline.name != "decode_baseline_scan")
+					continue;
+				for (const auto& r : m_results)
+				{
+					if (r.name != "decode" || r.format != baseline.format || r.size != baseline.size || r.corruption != baseline.corruption || r.seconds_per_call <= 0.0)
+						continue;
+					os << (first ? "" : ",\n") << "    { \"format\": \"" << r.format << "\", \"size\": " << r.size << ", \"corruption\": " << r.corruption
+						<< ", \"speedup\": " << baseline.seconds_per_call / r.seconds_per_call << " }";
+					first = false;
+				}
+			}
+			os << (first ? "" : "\n") << "  ]\n}\n";
+		}
+	private:
+		const bench_options& m_options;
+		std::vector<bench_result> m_results;
+	};
+
+	void bench_format(bench_runner& runner, const bench_options& options, const std::string& format_name, thug::morse_format fmt, thug::morse_format other_fmt)
+	{
+		using thug::morse_converter;
+		const morse_converter converter(fmt);
+		const baseline_decoder baseline(converter);
+		const double corruption_rates[] = { 0.0, 0.001, 0.01, 0.05 };
+		const auto work_dir = std::filesystem::temp_directory_path() / ("thug_bench_" + std::to_string(std::random_device{}()));
+		std::filesystem::create_directories(work_dir);
+		const std::string text_path = (work_dir / "text.txt").string();
+		const std::string morse_path = (work_dir / "morse.txt").string();
+		const std::string out_path = (work_dir / "out.txt").string();
+
+		for (uint64_t size = options.min_size; size <= options.max_size; size *= 4)
+		{
+			const std::string text = make_text(size);
+			const std::string morse = converter.encode(text);
+			const uint64_t tokens = text.size();
+
+			runner.run("encode", format_name, size, text.size(), 0.0, tokens, [&] { return converter.encode(text).size(); });
+			runner.run("switch_format", format_name, size, morse.size(), 0.0, tokens,
+				[&] { return morse_converter::switch_format(morse, fmt, other_fmt).size(); });
+
+			for (double rate : corruption_rates)
+			{
+				const std::string input = corrupt(morse, rate, fmt);
+				runner.run("decode", format_name, size, input.size(), rate, tokens, [&] { return converter.decode(input).size(); });
+				if (size <= options.baseline_max_size)
+					runner.run("decode_baseline_scan", format_name, size, input.size(), rate, tokens, [&] { return baseline.decode(input).size(); });
+				runner.run("is_valid_morse", format_name, size, input.size(), rate, tokens,
+					[&] { return static_cast<size_t>(morse_converter::is_valid_morse(input, fmt)); });
+				for (size_t mode = 0; mode < sizeof(repair_mode_names) / sizeof(repair_mode_names[0]); ++mode)
+				{
+					runner.run(std::string("repair_morse/") + repair_mode_names[mode], format_name, size, input.size(), rate, tokens,
+						[&] { return morse_converter::repair_morse(input, static_cast<thug::repair_mode>(mode), fmt).size(); });
+				}
+			}
+
+			if (size > options.file_max_size)
+				continue;
+			std::ofstream(text_path, std::ios::binary).write(text.data(), static_cast<std::streamsize>(text.size()));
+			std::ofstream(morse_path, std::ios::binary).write(morse.data(), static_cast<std::streamsize>(morse.size()));
+			runner.run("encode_file", format_name, size, text.size(), 0.0, tokens, [&] { return converter.encode_file(text_path).size(); });
+			runner.run("decode_file", format_name, size, morse.size(), 0.0, tokens, [&] { return converter.decode_file(morse_path).size(); });
+			runner.run("encode_file_to", format_name, size, text.size(), 0.0, tokens,
+				[&] { return static_cast<size_t>(converter.encode_file_to(text_path, out_path)); });
+			runner.run("decode_file_to", format_name, size, morse.size(), 0.0, tokens,
+				[&] { return static_cast<size_t>(converter.decode_file_to(morse_path, out_path)); });
+		}
+
+		std::error_code ec;
+		std::filesystem::remove_all(work_dir, ec);
+	}
+
+	bool parse_size(const char* arg, uint64_t& value)
+	{
+		char* end = nullptr;
+		value = std::strtoull(arg, &end, 10);
+		return end != arg && *end == '\0' && value != 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	bench_options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		bool ok = has_value;
+		if (arg == "--min-size" && has_value)
+			ok = parse_size(argv[++i], options.min_size);
+		else if (arg == "--max-size" && has_value)
+			ok = parse_size(argv[++i], options.max_size);
+		else if (arg == "--file-max-size" && has_value)
+			ok = parse_size(argv[++i], options.file_max_size);
+		else if (arg == "--baseline-max-size" && has_value)
+			ok = parse_size(argv[++i], options.baseline_max_size);
+		else if (arg == "--min-time" && has_value)
+			options.min_time = std::atof(argv[++i]);
+		else if (arg == "--filter" && has_value)
+			options.filter = argv[++i];
+		else if (arg == "--out" && has_value)
+			options.out = argv[++i];
+		else
+			ok = false;
+
+		if (!ok)
+		{
+			std::cerr << "usage: thug_bench [--min-size N] [--max-size N] [--file-max-size N] [--baseline-max-size N] [--min-time SECONDS] [--filter TEXT] [--out PATH]\n";
+			return 2;
+		}
+	}
+
+	bench_runner runner(options);
+	bench_format(runner, options, "default", thug::default_format, { '*', '_', '|' });
+	bench_format(runner, options, "custom", { '*', '_', '|' }, thug::default_format);
+
+	if (options.out.empty())
+	{
+		runner.write_json(std::cout);
+		return 0;
+	}
+	std::ofstream out(options.out);
+	runner.write_json(out);
+	return out ? 0 : 1;
+}
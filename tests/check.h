@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdio>
+
+// The tests are plain executables: every failed check is printed, and main returns thug_test::result().
+namespace thug_test
+{
+	inline int& failures()
+	{
+		static int count = 0;
+		return count;
+	}
+
+	inline int result()
+	{
+		if (failures() != 0)
+			std::fprintf(stderr, "%d check(s) failed\n", failures());
+		return failures() != 0 ? 1 : 0;
+	}
+
+	// Returned by tests that can't run in this build, such as without <memory_resource>.
+	constexpr int skipped = 77;
+}
+
+#define THUG_CHECK(condition) \
+	((condition) ? (void)0 : (std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition), (void)++thug_test::failures()))
@@ -0,0 +1,87 @@
+// Synthesized morse decodes back to the same text through morse_demodulator, with and without added noise.
+#include "thug.h"
+#include "check.h"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// The keyed text with leading and trailing silence, so the demodulator has to find the noise floor first.
+	std::vector<float> make_signal(const std::string& morse, double wpm, float noise, uint32_t seed)
+	{
+		thug::synthesis_options options;
+		options.wpm = wpm;
+		thug::morse_synthesizer synthesizer(options);
+		synthesizer.push(morse);
+
+		std::vector<float> audio(static_cast<size_t>(options.sample_rate) * 3, 0.0f);
+		std::vector<float> buffer(4096);
+		size_t count = 0;
+		while ((count = synthesizer.render(buffer.data(), buffer.size())) > 0)
+			audio.insert(audio.end(), buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(count));
+		audio.resize(audio.size() + static_cast<size_t>(options.sample_rate), 0.0f);
+
+		if (noise > 0.0f)
+		{
+			std::mt19937 rng(seed);
+			std::normal_distribution<float> gaussian(0.0f, noise);
+			for (float& sample : audio)
+				sample += gaussian(rng);
+		}
+		return audio;
+	}
+}
+
+int main()
+{
+	const thug::morse_converter converter;
+	const std::string text = "cq cq de dl1abc the quick brown fox jumps over the lazy dog 0123456789";
+	const std::string morse = converter.encode(text);
+
+	for (double wpm : { 12.0, 20.0, 30.0 })
+	{
+		// 0.8 is an SNR of about 0 dB over the full band, well under 20 dB in the tone's bandwidth.
+		for (float noise : { 0.0f, 0.3f, 0.8f })
+		{
+			std::vector<float> audio = make_signal(morse, wpm, noise, 1);
+			std::string decoded;
+			thug::morse_demodulator demodulator({}, thug::default_format, [&](std::string_view morse_out) { decoded += morse_out; });
+			for (size_t i = 0; i < audio.size(); i += 1000)
+				demodulator.push(audio.data() + i, std::min<size_t>(1000, audio.size() - i));
+			demodulator.finish();
+
+			std::string result = converter.decode(decoded);
+			if (!result.empty() && result.back() == ' ')
+				result.pop_back();
+			bool ok = result == text && std::fabs(demodulator.wpm() - wpm) < 0.15 * wpm;
+			if (!ok)
+				std::cerr << wpm << " wpm, noise " << noise << ": estimated " << demodulator.wpm() << " wpm, decoded \"" << result << "\"\n";
+			THUG_CHECK(ok);
+		}
+	}
+
+	// 16-bit input goes through the same path.
+	std::vector<float> audio = make_signal(converter.encode("test"), 20.0, 0.1f, 2);
+	std::vector<int16_t> pcm(audio.size());
+	for (size_t i = 0; i < audio.size(); ++i)
+		pcm[i] = static_cast<int16_t>(std::lround(std::max(-1.0f, std::min(1.0f, audio[i])) * 32767.0f));
+	std::string decoded;
+	thug::morse_demodulator demodulator({}, thug::default_format, [&](std::string_view morse_out) { decoded += morse_out; });
+	demodulator.push(pcm.data(), pcm.size());
+	demodulator.finish();
+	std::string result = converter.decode(decoded);
+	THUG_CHECK(result == "test" || result == "test ");
+
+	// Silence and pure noise decode to nothing.
+	std::vector<float> quiet = make_signal("", 20.0, 0.3f, 3);
+	decoded.clear();
+	thug::morse_demodulator idle({}, thug::default_format, [&](std::string_view morse_out) { decoded += morse_out; });
+	idle.push(quiet.data(), quiet.size());
+	idle.finish();
+	THUG_CHECK(decoded.find_first_not_of(' ') == std::string::npos);
+
+	return thug_test::result();
+}
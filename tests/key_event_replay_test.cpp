@@ -0,0 +1,108 @@
+// Replays keying traces through key_event_decoder: timing jitter, contact bounce, and zero-length or out-of-order events.
+#include "thug.h"
+#include "check.h"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+
+namespace
+{
+	enum trace_flags
+	{
+		jitter_only = 0,
+		with_bounce = 1, // a few sub-millisecond flips at every key edge
+		with_bad_events = 2 // zero-length marks and timestamps that go backwards after every mark
+	};
+
+	std::string replay(const std::string& morse, double wpm, int flags, double& estimated_wpm)
+	{
+		std::mt19937 rng(7);
+		std::normal_distribution<double> jitter(1.0, 0.1);
+		std::uniform_int_distribution<uint64_t> bounce(1, 500);
+		const double dit = 1.2e6 / wpm;
+		uint64_t t = 1000000;
+		auto length = [&](double units) { return static_cast<uint64_t>(std::max(1.0, units * dit * jitter(rng))); };
+
+		std::string text;
+		thug::key_event_decoder decoder(wpm * 1.2, [&](std::string_view out) { text += out; });
+		for (size_t i = 0; i < morse.size(); ++i)
+		{
+			char c = morse[i];
+			if (c == '/')
+				t += length(4.0);
+			if (c != '.' && c != '-')
+				continue;
+
+			decoder.key_down(t);
+			for (int k = 0; (flags & with_bounce) && k < 2; ++k)
+			{
+				decoder.key_up(t += bounce(rng));
+				decoder.key_down(t += bounce(rng));
+			}
+			t += length(c == '.' ? 1.0 : 3.0);
+			decoder.key_up(t);
+			if (flags & with_bounce)
+			{
+				decoder.key_down(t += bounce(rng));
+				decoder.key_up(t += bounce(rng));
+			}
+			if (flags & with_bad_events)
+			{
+				decoder.key_down(t);
+				decoder.key_up(t);
+				decoder.key_up(t - 5);
+				decoder.key_down(t - 3);
+				decoder.key_up(t - 3);
+			}
+
+			t += length(1.0);
+			if (i + 1 < morse.size() && morse[i + 1] == ' ')
+				t += length(2.0);
+		}
+		decoder.poll(t + static_cast<uint64_t>(10.0 * dit));
+		decoder.finish();
+		estimated_wpm = decoder.wpm();
+
+		// poll has already seen the word gap after the last letter.
+		if (!text.empty() && text.back() == ' ')
+			text.pop_back();
+		return text;
+	}
+}
+
+int main()
+{
+	const std::string text = "cq cq cq de dl1abc the quick brown fox";
+	const std::string morse = thug::morse_converter().encode(text);
+
+	for (double wpm : { 8.0, 20.0, 35.0 })
+	{
+		for (int flags : { int(jitter_only), int(with_bounce), int(with_bad_events), with_bounce | with_bad_events })
+		{
+			double estimated_wpm = 0.0;
+			std::string decoded = replay(morse, wpm, flags, estimated_wpm);
+			bool ok = decoded == text && std::isfinite(estimated_wpm) && std::fabs(estimated_wpm - wpm) < 0.15 * wpm;
+			if (!ok)
+				std::cerr << wpm << " wpm, flags " << flags << ": estimated " << estimated_wpm << " wpm, decoded \"" << decoded << "\"\n";
+			THUG_CHECK(ok);
+		}
+	}
+
+	// Nothing but bounce and zero-length events decodes to nothing, and the speed stays a number.
+	std::string out;
+	thug::key_event_decoder decoder(20.0, [&](std::string_view text_out) { out += text_out; });
+	for (uint64_t t = 1000; t < 1000000; t += 20000)
+	{
+		decoder.key_down(t);
+		decoder.key_up(t);
+		decoder.key_down(t + 100);
+		decoder.key_up(t + 300);
+	}
+	decoder.poll(2000000);
+	decoder.finish();
+	THUG_CHECK(out.find_first_not_of(' ') == std::string::npos);
+	THUG_CHECK(std::isfinite(decoder.wpm()) && decoder.wpm() > 0.0);
+
+	return thug_test::result();
+}
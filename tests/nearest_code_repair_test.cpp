@@ -0,0 +1,98 @@
+// try_nearest_valid_code picks a code at the smallest edit distance, and among those the one closest in length to the token.
+#include "thug.h"
+#include "check.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	size_t edit_distance(const std::string& a, const std::string& b)
+	{
+		std::vector<size_t> row(b.size() + 1);
+		for (size_t j = 0; j <= b.size(); ++j)
+			row[j] = j;
+		for (size_t i = 1; i <= a.size(); ++i)
+		{
+			size_t diagonal = row[0];
+			row[0] = i;
+			for (size_t j = 1; j <= b.size(); ++j)
+			{
+				size_t above = row[j];
+				row[j] = std::min({ row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] == b[j - 1] ? 0 : 1) });
+				diagonal = above;
+			}
+		}
+		return row[b.size()];
+	}
+
+	size_t length_gap(size_t a, size_t b)
+	{
+		return a > b ? a - b : b - a;
+	}
+}
+
+int main()
+{
+	using thug::morse_converter;
+	const auto nearest = [](const std::string& token) { return morse_converter::repair_morse(token, thug::repair_mode::try_nearest_valid_code); };
+
+	// A bad key is substituted rather than dropped when both are one edit away.
+	THUG_CHECK(nearest(".-x-") == ".---");
+	THUG_CHECK(nearest("-x..") == "-...");
+	THUG_CHECK(nearest("..-..") != "....");
+	THUG_CHECK(nearest("..-..").size() == 5);
+
+	// Every code of up to 7 keys.
+	std::vector<std::string> codes;
+	for (size_t length = 1; length <= 7; ++length)
+	{
+		for (size_t bits = 0; bits < (size_t(1) << length); ++bits)
+		{
+			std::string code;
+			for (size_t k = length; k-- > 0;)
+				code += ((bits >> k) & 1u) ? '-' : '.';
+			if (morse_converter::is_valid_morse(code) && !morse_converter().decode(code).empty())
+				codes.push_back(code);
+		}
+	}
+	THUG_CHECK(codes.size() > 40);
+
+	// All tokens of up to 6 keys from short press, long press and a foreign byte, against a brute force search.
+	const char keys[] = { '.', '-', 'x' };
+	size_t mismatches = 0;
+	for (size_t length = 1; length <= 6; ++length)
+	{
+		size_t count = 1;
+		for (size_t i = 0; i < length; ++i)
+			count *= 3;
+		for (size_t n = 0; n < count; ++n)
+		{
+			std::string token;
+			for (size_t i = 0, rest = n; i < length; ++i, rest /= 3)
+				token += keys[rest % 3];
+
+			size_t best_distance = 3, best_gap = 0; // nothing further than the default distance of 2 is repaired
+			for (const auto& code : codes)
+			{
+				size_t distance = edit_distance(token, code);
+				size_t gap = length_gap(code.size(), token.size());
+				if (distance < best_distance || (distance == best_distance && gap < best_gap))
+				{
+					best_distance = distance;
+					best_gap = gap;
+				}
+			}
+
+			std::string repaired = nearest(token);
+			bool ok = best_distance > 2 ? repaired.empty()
+				: !repaired.empty() && edit_distance(token, repaired) == best_distance && length_gap(repaired.size(), token.size()) == best_gap;
+			if (!ok && ++mismatches <= 5)
+				std::cerr << token << " was repaired to \"" << repaired << "\", expected distance " << best_distance << " and length gap " << best_gap << "\n";
+		}
+	}
+	THUG_CHECK(mismatches == 0);
+
+	return thug_test::result();
+}
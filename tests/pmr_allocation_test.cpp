@@ -0,0 +1,101 @@
+// Once warmed up, conversions into a caller's arena or a reused string make no global heap allocations.
+#include "thug.h"
+#include "check.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	std::atomic<unsigned long> g_allocations{ 0 };
+}
+
+void* operator new(std::size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size != 0 ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+#ifdef THUG_HAS_PMR
+namespace
+{
+	// Global allocations made by fn.
+	template <typename Fn>
+	unsigned long allocations_of(Fn&& fn)
+	{
+		unsigned long before = g_allocations.load(std::memory_order_relaxed);
+		fn();
+		return g_allocations.load(std::memory_order_relaxed) - before;
+	}
+}
+
+int main()
+{
+	thug::morse_converter converter;
+	const std::string text = "cq cq de dl1abc the quick brown fox jumps over the lazy dog 0123456789";
+	const std::string morse = converter.encode(text);
+	const std::string broken = ".- .x- ...x --.-- / -.. .";
+
+	// An arena that can't fall back to the heap: running out of it throws instead of allocating.
+	alignas(std::max_align_t) static char buffer[1 << 16];
+	std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+
+	// Warm up: builds and caches the tables of the format.
+	THUG_CHECK(std::string_view(converter.decode(morse, &arena)) == text);
+	arena.release();
+
+	THUG_CHECK(allocations_of([&]
+		{
+			for (int i = 0; i < 100; ++i)
+			{
+				THUG_CHECK(std::string_view(converter.decode(morse, &arena)) == text);
+				arena.release();
+			}
+		}) == 0);
+
+	THUG_CHECK(allocations_of([&]
+		{
+			THUG_CHECK(std::string_view(converter.encode(text, &arena)) == morse);
+			arena.release();
+		}) == 0);
+
+	for (auto mode : { thug::repair_mode::remove_incorrect_letter, thug::repair_mode::remove_incorrect_key, thug::repair_mode::try_nearest_valid_code })
+	{
+		THUG_CHECK(allocations_of([&]
+			{
+				THUG_CHECK(!thug::morse_converter::repair_morse(broken, &arena, mode).empty());
+				arena.release();
+			}) == 0);
+	}
+
+	// A std::string that already has the capacity is reused as it is.
+	std::string out;
+	converter.decode_into(morse, out);
+	THUG_CHECK(allocations_of([&]
+		{
+			for (int i = 0; i < 100; ++i)
+				converter.decode_into(morse, out);
+		}) == 0);
+	THUG_CHECK(out == text);
+
+	return thug_test::result();
+}
+#else // THUG_HAS_PMR
+int main()
+{
+	return thug_test::skipped;
+}
+#endif // THUG_HAS_PMR
@@ -0,0 +1,86 @@
+// Repairs with per-call and per-converter policies while other threads keep changing the global repair order.
+// Built with -fsanitize=thread where the compiler has it, so a data race fails the test.
+#include "thug.h"
+#include "check.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+int main()
+{
+	using thug::morse_converter;
+	using thug::repair_mode;
+	using thug::repair_policy;
+
+	const std::string morse = "... --x ..-- -?- .-.-.-.-.-.-. --- ... x.x";
+	const repair_mode ordered = repair_mode::try_ordered_repair_list_one_by_one;
+	const repair_policy short_first{ repair_mode::try_replacing_with_short_press };
+	const repair_policy long_first{ repair_mode::try_replacing_with_long_press };
+
+	// What each order gives, worked out before any thread starts.
+	const std::string short_text = morse_converter::repair_and_decode(morse, ordered, short_first);
+	const std::string long_text = morse_converter::repair_and_decode(morse, ordered, long_first);
+	const std::string default_text = morse_converter::repair_and_decode(morse, ordered, repair_policy{});
+	const std::string short_morse = morse_converter::repair_morse(morse, ordered, short_first);
+	const std::string long_morse = morse_converter::repair_morse(morse, ordered, long_first);
+	THUG_CHECK(short_text != long_text);
+
+	// The static API is a wrapper over the same policy.
+	morse_converter::set_repair_order({ repair_mode::try_replacing_with_short_press });
+	THUG_CHECK(morse_converter::repair_and_decode(morse, ordered) == short_text);
+	THUG_CHECK(morse_converter::get_repair_order().size() == 1);
+	morse_converter::set_repair_order({ repair_mode::remove_incorrect_key, repair_mode::try_replacing_with_short_press, repair_mode::try_replacing_with_long_press });
+
+	std::atomic<bool> stop{ false };
+	std::atomic<int> errors{ 0 };
+	std::vector<std::thread> threads;
+
+	for (int t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&, t]
+			{
+				const repair_policy& policy = t % 2 != 0 ? long_first : short_first;
+				const std::string& expected_text = t % 2 != 0 ? long_text : short_text;
+				const std::string& expected_morse = t % 2 != 0 ? long_morse : short_morse;
+				morse_converter converter;
+				converter.set_repair_policy(policy);
+				for (int i = 0; i < 2000; ++i)
+				{
+					if (converter.decode_repaired(morse, ordered) != expected_text)
+						++errors;
+					if (morse_converter::repair_morse(morse, ordered, policy) != expected_morse)
+						++errors;
+					// The global order is whichever one was set last, but never a mix of two.
+					std::string text = morse_converter::repair_and_decode(morse, ordered);
+					if (text != short_text && text != long_text && text != default_text)
+						++errors;
+					std::string fixed = morse_converter::repair_morse(morse, ordered);
+					if (fixed != short_morse && fixed != long_morse && fixed != morse_converter::repair_morse(morse, ordered, repair_policy{}))
+						++errors;
+				}
+			});
+	}
+	for (int t = 0; t < 2; ++t)
+	{
+		threads.emplace_back([&, t]
+			{
+				for (int i = 0; !stop.load(); ++i)
+				{
+					if ((i + t) % 2 != 0)
+						morse_converter::set_repair_order({ repair_mode::try_replacing_with_short_press });
+					else
+						morse_converter::set_repair_order({ repair_mode::try_replacing_with_long_press, repair_mode::try_replacing_with_long_press });
+				}
+			});
+	}
+
+	for (int t = 0; t < 4; ++t)
+		threads[t].join();
+	stop = true;
+	for (size_t t = 4; t < threads.size(); ++t)
+		threads[t].join();
+
+	THUG_CHECK(errors.load() == 0);
+	return thug_test::result();
+}
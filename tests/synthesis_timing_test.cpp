@@ -0,0 +1,105 @@
+// morse_synthesizer keys morse with the expected timing units, Farnsworth spacing included.
+#include "thug.h"
+#include "check.h"
+
+#include <cmath>
+#include <vector>
+
+namespace
+{
+	std::vector<float> render_all(thug::morse_synthesizer& synthesizer, size_t block)
+	{
+		std::vector<float> samples, buffer(block);
+		size_t count = 0;
+		while ((count = synthesizer.render(buffer.data(), buffer.size())) > 0)
+			samples.insert(samples.end(), buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(count));
+		return samples;
+	}
+
+	float peak(const std::vector<float>& samples, size_t begin, size_t end)
+	{
+		float result = 0.0f;
+		for (size_t i = begin; i < end; ++i)
+			result = std::max(result, std::fabs(samples[i]));
+		return result;
+	}
+
+	thug::morse_synthesizer make_synthesizer(double wpm)
+	{
+		thug::synthesis_options options;
+		options.wpm = wpm;
+		return thug::morse_synthesizer(options);
+	}
+}
+
+int main()
+{
+	thug::morse_converter converter;
+
+	// 20 wpm at 48 kHz: a unit is 60 ms.
+	thug::synthesis_options options;
+	auto timing = thug::morse_timing::from(options);
+	THUG_CHECK(timing.unit == 2880);
+	THUG_CHECK(timing.dah == 3 * timing.unit);
+	THUG_CHECK(timing.letter_gap == 3 * timing.unit);
+	THUG_CHECK(timing.word_gap == 7 * timing.unit);
+
+	// PARIS is 50 units with the word gap after it, 43 without.
+	thug::morse_synthesizer synthesizer(options);
+	THUG_CHECK(synthesizer.sample_count(converter.encode("paris")) == 43 * timing.unit);
+	THUG_CHECK(synthesizer.sample_count(converter.encode("paris paris")) == (50 + 43) * timing.unit);
+	THUG_CHECK(synthesizer.sample_count(converter.encode("e")) == timing.unit);
+	THUG_CHECK(synthesizer.sample_count("") == 0);
+
+	// Farnsworth: characters at 20 wpm, but each PARIS with its word gap takes 60 / 10 seconds.
+	thug::synthesis_options farnsworth = options;
+	farnsworth.farnsworth_wpm = 10.0;
+	auto slow = thug::morse_timing::from(farnsworth);
+	THUG_CHECK(slow.unit == timing.unit && slow.dah == timing.dah);
+	THUG_CHECK(slow.letter_gap > timing.letter_gap && slow.word_gap > timing.word_gap);
+	thug::morse_synthesizer spaced(farnsworth);
+	size_t word = spaced.sample_count(converter.encode("paris paris")) - spaced.sample_count(converter.encode("paris"));
+	THUG_CHECK(word >= 6 * 48000 - 4 && word <= 6 * 48000 + 4);
+
+	// The rendered keying: "a" is a dit, a unit of silence and a dah. Silences are exactly zero, tones reach the amplitude.
+	synthesizer.push(converter.encode("a"));
+	std::vector<float> samples = render_all(synthesizer, 1000);
+	const size_t unit = timing.unit;
+	THUG_CHECK(samples.size() == 5 * unit);
+	THUG_CHECK(peak(samples, 0, unit) > 0.75f);
+	THUG_CHECK(peak(samples, unit, 2 * unit) == 0.0f);
+	THUG_CHECK(peak(samples, 2 * unit, 5 * unit) > 0.75f);
+	THUG_CHECK(peak(samples, 0, samples.size()) <= options.amplitude + 1e-6f);
+	THUG_CHECK(std::fabs(samples[0]) < 0.01f && std::fabs(samples[unit - 1]) < 0.01f); // raised-cosine edges
+
+	// Block size doesn't change the output, and a letter split between pushes is keyed as one letter.
+	const std::string morse = converter.encode("cq de dl1abc");
+	thug::morse_synthesizer whole(options), pieces(options);
+	whole.push(morse);
+	pieces.push(morse.substr(0, 5));
+	pieces.push(morse.substr(5));
+	std::vector<float> reference = render_all(whole, 4096);
+	THUG_CHECK(reference.size() == whole.sample_count(morse));
+	THUG_CHECK(render_all(pieces, 37) == reference);
+
+	// 16-bit output is the float output scaled.
+	thug::morse_synthesizer pcm(options);
+	pcm.push(morse);
+	std::vector<int16_t> pcm_samples(reference.size() + 10);
+	THUG_CHECK(pcm.render(pcm_samples.data(), pcm_samples.size()) == reference.size());
+	THUG_CHECK(pcm_samples[reference.size() / 3] == static_cast<int16_t>(std::lround(reference[reference.size() / 3] * 32767.0f)));
+
+	// Copied and moved synthesizers keep their own timing.
+	std::vector<thug::morse_synthesizer> synthesizers;
+	synthesizers.push_back(make_synthesizer(25.0));
+	synthesizers.push_back(make_synthesizer(25.0));
+	auto copy = synthesizers[0];
+	synthesizers[1].push(morse);
+	copy.push(morse);
+	size_t expected = synthesizers[1].sample_count(morse);
+	THUG_CHECK(render_all(synthesizers[1], 512).size() == expected);
+	THUG_CHECK(render_all(copy, 512).size() == expected);
+	THUG_CHECK(copy.timing().unit == static_cast<size_t>(std::lround(1.2 / 25.0 * 48000)));
+
+	return thug_test::result();
+}
@@ -1,40 +1,91 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <cstdint>
 #include <sstream>
 #include <fstream>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
+#include <memory>
+#include <mutex>
 #include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define THUG_HAS_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define THUG_TARGET_AVX2
+#else
+#define THUG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#define THUG_HAS_SPAN 1
+#include <span>
+#endif
+
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#define THUG_HAS_PMR 1
+#include <memory_resource>
+#endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define THUG_HAS_MMAP 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Define THUG_ENABLE_STATS to count what conversions do (see conversion_stats). Without it the counting code is not compiled at all.
+#ifdef THUG_ENABLE_STATS
+#define THUG_STATS(...) __VA_ARGS__
+#else
+#define THUG_STATS(...)
+#endif
+#define THUG_STATS_TIMER(stage) THUG_STATS(::thug::detail::stage_timer thug_stage_timer(stage);)
 
 namespace thug
 {
 	namespace detail
 	{
-		std::vector<std::string> separate_string(const std::string& source)
+		struct morse_code_entry
 		{
-			std::string temp = "";
-			std::vector<std::string> result;
-
-			for (size_t i = 0; i < source.size(); i++)
-			{
-				if (!::isspace(source[i]))
-				{
-					temp += source[i];
-				}
-				else
-				{
-					if (temp.empty())
-						continue;
-					result.push_back(temp);
-					temp = "";
-				}
-			}
-			if (!temp.empty())
-				result.push_back(temp);
+			char letter;
+			const char* code; // written in default_format
+		};
 
-			return result;
-		}
+		// When two letters share a code, decoding picks the one that comes first here.
+		constexpr morse_code_entry morse_code_table[] =
+		{
+			{ 'a', ".-" }, { 'b', "-..." }, { 'c', "-.-." }, { 'd', "-.." }, { 'e', "." }, { 'f', "..-." }, { 'g', "--." },
+			{ 'h', "...." }, { 'i', ".." }, { 'j', ".---" }, { 'k', "-.-" }, { 'l', ".-.." }, { 'm', "--" }, { 'n', "-." },
+			{ 'o', "---" }, { 'p', ".--." }, { 'q', "--.-" }, { 'r', ".-." }, { 's', "..." }, { 't', "-" }, { 'u', "..-" },
+			{ 'v', "...-" }, { 'w', ".--" }, { 'x', "-..-" }, { 'y', "-.--" }, { 'z', "--.." },
+			{ '0', "-----" }, { '1', ".----" }, { '2', "..---" }, { '3', "...--" }, { '4', "....-" },
+			{ '5', "....." }, { '6', "-...." }, { '7', "--..." }, { '8', "---.." }, { '9', "----." },
+			{ '.', ".-.-.-" }, { ',', "--..--" }, { '?', "..--.." }, { '/', "-..-." }, { '(', "-.--." }, { ')', "-.--.-" },
+			{ ':', "---..." }, { '=', "-...-" }, { '+', ".-.-." }, { '-', "-....-" }, { '@', ".--.-." }, { '\'', ".----." },
+			{ '\"', ".-..-." }, { '\\', "-..-." },
+			{ ' ', "" }, // the space letter is written as a single space key
+			// these are nonstandart
+			{ '!', "-.-.--" }, { '&', ".-..." }, { ';', "-.-.-." }, { '_', "..--.-" }, { '$', "...-..-" },
+		};
 	}
 
 	struct morse_format
@@ -56,556 +107,3981 @@ namespace thug
 
 	constexpr morse_format default_format{};
 
-	enum class repair_mode
+#ifdef THUG_ENABLE_STATS
+	enum class conversion_stage
 	{
-		remove_incorrect_letter = 0, // Completely removes the incorrect letter
-		remove_incorrect_key = 1, // It first tries to remove the wrong key. If the result doesn't make sense, it removes that letter entirely.
-		try_replacing_with_short_press = 2, // It tries to replace the faulty key with short press key. If the result doesn't make sense, it removes that letter entirely.
-		try_replacing_with_long_press = 3, // It tries to replace the faulty key with long press key. If the result doesn't make sense, it removes that letter entirely.
-		try_ordered_repair_list_one_by_one = 4, // It tries the repairs on the ordered list one by one. If none of them work, it removes the letter entirely.
-		default_mode = remove_incorrect_letter // Default mode is remove_incorrect_letter
+		encode = 0,
+		decode,
+		repair,
+		validate,
+		count
 	};
 
-	class morse_converter
+	// Counters of one thread. Work that a conversion hands to other threads is added to the thread that called it, so times are CPU time.
+	struct conversion_stats
 	{
-	public:
-		morse_converter(char long_press_key = default_format.long_press, char short_press_key = default_format.short_press, char space_key = default_format.space) : m_format({ long_press_key, short_press_key, space_key })
+		uint64_t bytes_in = 0; // text read by encode, morse read by decode, repair and validation
+		uint64_t bytes_out = 0;
+		uint64_t letters = 0; // letters encoded, unknown ones included
+		uint64_t dropped_letters = 0; // bytes or code points encode has no code for
+		uint64_t tokens = 0; // tokens decoded or repaired
+		uint64_t unknown_tokens = 0; // tokens decode dropped
+		uint64_t repairs[6] = {}; // invalid letters fixed, by the repair_mode value that fixed them
+		uint64_t removed_letters = 0; // invalid letters repair couldn't fix
+		uint64_t nanoseconds[static_cast<size_t>(conversion_stage::count)] = {};
+
+		conversion_stats& operator+=(const conversion_stats& right) noexcept
 		{
-			m_keys = get_key_table(m_format);
+			bytes_in += right.bytes_in;
+			bytes_out += right.bytes_out;
+			letters += right.letters;
+			dropped_letters += right.dropped_letters;
+			tokens += right.tokens;
+			unknown_tokens += right.unknown_tokens;
+			for (size_t i = 0; i < std::size(repairs); ++i)
+				repairs[i] += right.repairs[i];
+			removed_letters += right.removed_letters;
+			for (size_t i = 0; i < std::size(nanoseconds); ++i)
+				nanoseconds[i] += right.nanoseconds[i];
+			return *this;
 		}
+	};
 
-		morse_converter(morse_format fmt) : m_format(fmt)
+	namespace detail
+	{
+		inline conversion_stats& thread_stats() noexcept
 		{
-			m_keys = get_key_table(m_format);
+			thread_local conversion_stats stats;
+			return stats;
 		}
 
-		morse_converter(const morse_converter& other) : m_format(other.m_format)
+		// Adds the time until it goes out of scope to a stage.
+		class stage_timer
 		{
-			m_keys = get_key_table(m_format);
-		}
+		public:
+			explicit stage_timer(conversion_stage stage) noexcept : m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
 
-		morse_converter(morse_converter&& other) noexcept : m_format(std::move(other).m_format), m_keys(std::move(other).m_keys) {}
+			stage_timer(const stage_timer&) = delete;
+			stage_timer& operator=(const stage_timer&) = delete;
 
-		morse_converter& operator=(morse_format fmt)
+			~stage_timer()
+			{
+				auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+				thread_stats().nanoseconds[static_cast<size_t>(m_stage)] += static_cast<uint64_t>(elapsed.count());
+			}
+		private:
+			conversion_stage m_stage;
+			std::chrono::steady_clock::time_point m_start;
+		};
+	}
+
+	// The counters of the calling thread since it started or since the last reset.
+	inline conversion_stats thread_conversion_stats() noexcept
+	{
+		return detail::thread_stats();
+	}
+
+	inline void reset_thread_conversion_stats() noexcept
+	{
+		detail::thread_stats() = conversion_stats{};
+	}
+#endif // THUG_ENABLE_STATS
+
+	namespace detail
+	{
+		// No letter has a code longer than this, so a packed code always fits in a byte.
+		constexpr size_t max_code_length = 7;
+
+		// A code of n keys is packed as (1 << n) | keys, long press being 1 and the first key the most significant bit.
+		// The leading 1 keeps codes of different lengths apart. The space letter has the empty code, so it packs to 1.
+		constexpr uint8_t pack_code(const char* code) noexcept
 		{
-			set_format(fmt);
+			unsigned packed = 1;
+			for (; *code != '\0'; ++code)
+				packed = (packed << 1) | (*code == default_format.long_press ? 1u : 0u);
+			return static_cast<uint8_t>(packed);
 		}
 
-		morse_converter& operator=(const morse_converter& other)
+		struct decode_index
 		{
-			set_format(other.m_format);
-		}
+			char letters[256] = {}; // '\0' means that no letter has this packed code
+		};
 
-		void set_format(char long_press_key, char short_press_key, char space_key = default_format.space)
+		constexpr decode_index make_decode_index() noexcept
 		{
-			auto temp = m_format;
-			m_format = { long_press_key, short_press_key, space_key };
-			m_keys = get_key_table(m_format);
+			decode_index result{};
+			for (const auto& entry : morse_code_table)
+			{
+				auto packed = pack_code(entry.code);
+				if (result.letters[packed] == '\0')
+					result.letters[packed] = entry.letter;
+			}
+			return result;
 		}
 
-		void set_format(morse_format fmt)
+		// Packed codes do not depend on the format, only the keys that spell them do. So one table serves every format.
+		inline constexpr decode_index morse_decode_index = make_decode_index();
+
+		struct code_string
 		{
-			auto temp = m_format;
-			m_format = fmt;
-			m_keys = get_key_table(m_format);
+			char keys[max_code_length] = {};
+			uint8_t size = 0;
+		};
+
+		struct encode_table
+		{
+			code_string codes[256] = {}; // indexed by byte, an empty code means that the byte has no letter
+		};
+
+		constexpr encode_table make_encode_table(morse_format fmt) noexcept
+		{
+			encode_table result{};
+			for (const auto& entry : morse_code_table)
+			{
+				code_string code{};
+				if (entry.code[0] == '\0')
+					code.keys[code.size++] = fmt.space;
+				for (const char* key = entry.code; *key != '\0'; ++key)
+					code.keys[code.size++] = (*key == default_format.long_press) ? fmt.long_press : fmt.short_press;
+
+				result.codes[static_cast<uint8_t>(entry.letter)] = code;
+				if (entry.letter >= 'a' && entry.letter <= 'z') // encode is case insensitive
+					result.codes[static_cast<uint8_t>(entry.letter - 'a' + 'A')] = code;
+			}
+			return result;
 		}
 
-		// text to morse
-		std::string encode(const std::string& text) const
+		enum class key_class : uint8_t
 		{
-			std::stringstream ss;
-			for (size_t i = 0; i < text.size(); ++i)
+			other = 0,
+			short_press,
+			long_press,
+			space,
+			separator // whitespace between tokens
+		};
+
+		struct key_class_table
+		{
+			key_class classes[256] = {};
+
+			constexpr key_class operator[](char c) const noexcept
 			{
-				if (m_keys.find(tolower(text[i])) != m_keys.end())
-					ss << m_keys.at(tolower(text[i]));
-				if (i != text.size() - 1)
-					ss << ' ';
+				return classes[static_cast<uint8_t>(c)];
 			}
-			return ss.str();
+		};
+
+		constexpr key_class_table make_key_class_table(morse_format fmt) noexcept
+		{
+			key_class_table result{};
+			result.classes[static_cast<uint8_t>(fmt.space)] = key_class::space;
+			result.classes[static_cast<uint8_t>(fmt.short_press)] = key_class::short_press;
+			result.classes[static_cast<uint8_t>(fmt.long_press)] = key_class::long_press;
+			for (char c : { ' ', '\t', '\n', '\v', '\f', '\r' })
+				result.classes[static_cast<uint8_t>(c)] = key_class::separator;
+			return result;
 		}
 
-		// morse to text
-		std::string decode(const std::string& morse) const
+		// Builds the packed code of a token key by key, so callers can decode without cutting the input into strings.
+		class token_decoder
 		{
-			std::stringstream ss;
-			auto parsed_text = detail::separate_string(morse);
-			if (parsed_text.size() == 0)
-				return std::string{};
-			for (auto& item : parsed_text)
+		public:
+			bool empty() const noexcept
 			{
-#if _HAS_CXX17
-				for (auto& [key, value] : m_keys)
-				{
-#else // _HAS_CXX17
-				for (auto& it : m_keys)
+				return m_length == 0;
+			}
+
+			void push(key_class key) noexcept
+			{
+				++m_length;
+				switch (key)
 				{
-					auto& key = it.first;
-					auto& value = it.second;
-#endif // _HAS_CXX17
-					if (value == item)
-					{
-						ss << key;
-						break;
-					}
+				case key_class::long_press:
+					m_packed = (m_packed << 1) | 1u;
+					break;
+				case key_class::short_press:
+					m_packed <<= 1;
+					break;
+				case key_class::space:
+					m_space = (m_length == 1);
+					m_valid = false;
+					break;
+				default:
+					m_valid = false;
+					break;
 				}
-				}
-			return ss.str();
 			}
 
-		std::string encode_file(const std::string& file) const
-		{
-			std::ifstream istr(file);
-			std::stringstream ss;
-			if (istr.is_open())
+			// Returns the packed code of the finished token, or 0 if it is not made of keys only. Starts the next token.
+			uint8_t finish_code() noexcept
 			{
-				ss << istr.rdbuf();
-				istr.close();
+				uint8_t code = 0;
+				if (m_length == 1 && m_space)
+					code = 1;
+				else if (m_valid && m_length != 0 && m_length <= max_code_length)
+					code = static_cast<uint8_t>(m_packed);
+				*this = token_decoder{};
+				return code;
 			}
-			return encode(ss.str());
-		}
 
-		std::string decode_file(const std::string& file) const
-		{
-			std::ifstream istr(file);
-			std::stringstream ss;
-			if (istr.is_open())
+			// Returns the letter of the finished token, or '\0' if it is not a valid code. Starts the next token.
+			char finish() noexcept
 			{
-				ss << istr.rdbuf();
-				istr.close();
+				return morse_decode_index.letters[finish_code()];
 			}
-			return decode(ss.str());
-		}
+		private:
+			unsigned m_packed = 1;
+			size_t m_length = 0;
+			bool m_valid = true;
+			bool m_space = false;
+		};
 
-		std::string default_to_member(const std::string& morse_text) const
+		// Exact size of the encoded text: every byte yields its code (possibly empty) and a separator, except the last one.
+		inline size_t encoded_size(std::string_view text, const encode_table& table) noexcept
 		{
-			return switch_format(morse_text, default_format, m_format);
+			if (text.empty())
+				return 0;
+			size_t size = text.size() - 1;
+			for (char c : text)
+				size += table.codes[static_cast<uint8_t>(c)].size;
+			return size;
 		}
 
-		std::string member_to_default(const std::string& morse_text) const
+		// out must have room for encoded_size(text) bytes. Returns the end of the written output.
+		template <typename OutputIt>
+		OutputIt encode_to(std::string_view text, const encode_table& table, OutputIt out)
 		{
-			return switch_format(morse_text, m_format, default_format);
+			THUG_STATS_TIMER(conversion_stage::encode);
+			THUG_STATS(size_t written = 0, dropped = 0;)
+			for (size_t i = 0; i < text.size(); ++i)
+			{
+				const auto& code = table.codes[static_cast<uint8_t>(text[i])];
+				for (uint8_t k = 0; k < code.size; ++k)
+					*out++ = code.keys[k];
+				if (i != text.size() - 1)
+					*out++ = ' ';
+				THUG_STATS(written += code.size; dropped += code.size == 0;)
+			}
+			THUG_STATS(auto& stats = thread_stats(); stats.bytes_in += text.size(); stats.letters += text.size(); stats.dropped_letters += dropped;)
+			THUG_STATS(stats.bytes_out += text.empty() ? 0 : written + text.size() - 1;)
+			return out;
 		}
 
-		std::string switch_format_to_member(const std::string& morse_text, morse_format fmt) const
+		// Tokens are at least one byte long and separated by at least one byte, so there can't be more letters than this.
+		constexpr size_t decoded_size_upper_bound(std::string_view morse) noexcept
 		{
-			return switch_format(morse_text, fmt, m_format);
+			return (morse.size() + 1) / 2;
 		}
 
-		std::string switch_format_from_member(const std::string& morse_text, morse_format fmt) const
+		// Calls fn with the packed code of every token in morse, 0 for tokens that are not made of keys only.
+		template <typename Fn>
+		void for_each_token_code(std::string_view morse, const key_class_table& classes, Fn&& fn)
 		{
-			return switch_format(morse_text, m_format, fmt);
+			token_decoder token;
+			for (char c : morse)
+			{
+				auto key = classes[c];
+				if (key != key_class::separator)
+					token.push(key);
+				else if (!token.empty())
+					fn(token.finish_code());
+			}
+			if (!token.empty())
+				fn(token.finish_code());
 		}
 
-		std::string switch_format_to_member(const std::string& morse_text, char lpk, char spk, char sk) const
+		// out must have room for decoded_size_upper_bound(morse) bytes. Returns the end of the written output.
+		template <typename OutputIt>
+		OutputIt decode_to(std::string_view morse, const key_class_table& classes, OutputIt out)
 		{
-			return switch_format(morse_text, { lpk, spk, sk }, m_format);
+			THUG_STATS_TIMER(conversion_stage::decode);
+			THUG_STATS(size_t tokens = 0, unknown = 0;)
+			for_each_token_code(morse, classes, [&](uint8_t code)
+				{
+					char letter = morse_decode_index.letters[code];
+					if (letter != '\0')
+						*out++ = letter;
+					THUG_STATS(++tokens; unknown += letter == '\0';)
+				});
+			THUG_STATS(auto& stats = thread_stats(); stats.bytes_in += morse.size(); stats.bytes_out += tokens - unknown; stats.tokens += tokens; stats.unknown_tokens += unknown;)
+			return out;
 		}
 
-		std::string switch_format_from_member(const std::string& morse_text, char lpk, char spk, char sk) const
+		// Whitespace as the C locale has it: ' ' and '\t' .. '\r'. The same in every locale, and the same set key_class_table marks as separators.
+		constexpr bool is_separator(char c) noexcept
 		{
-			return switch_format(morse_text, m_format, { lpk, spk, sk });
+			return c == ' ' || (c >= '\t' && c <= '\r');
 		}
 
-		static std::string switch_format(const std::string& morse_text, morse_format old_fmt, morse_format new_fmt)
+		/*
+		* @brief The whitespace separated tokens of a text, as views into it.
+		* Tokens are found while the range is walked, so nothing is copied or allocated and a consumer can stop early.
+		*/
+		class token_range
 		{
-			if (old_fmt == new_fmt)
-				return morse_text;
-			std::stringstream ss;
-			for (char item : morse_text)
+		public:
+			class iterator
+			{
+			public:
+				using iterator_category = std::forward_iterator_tag;
+				using value_type = std::string_view;
+				using difference_type = std::ptrdiff_t;
+				using pointer = const std::string_view*;
+				using reference = const std::string_view&;
+
+				iterator() noexcept = default;
+
+				iterator(std::string_view text, size_t pos) noexcept : m_text(text), m_next(pos)
+				{
+					advance();
+				}
+
+				reference operator*() const noexcept
+				{
+					return m_token;
+				}
+
+				pointer operator->() const noexcept
+				{
+					return &m_token;
+				}
+
+				iterator& operator++() noexcept
+				{
+					advance();
+					return *this;
+				}
+
+				iterator operator++(int) noexcept
+				{
+					iterator old = *this;
+					advance();
+					return old;
+				}
+
+				// Only iterators of the same range can be compared.
+				bool operator==(const iterator& right) const noexcept
+				{
+					return m_start == right.m_start;
+				}
+
+				bool operator!=(const iterator& right) const noexcept
+				{
+					return m_start != right.m_start;
+				}
+			private:
+				void advance() noexcept
+				{
+					size_t pos = m_next;
+					while (pos < m_text.size() && is_separator(m_text[pos]))
+						++pos;
+					m_start = pos;
+					while (pos < m_text.size() && !is_separator(m_text[pos]))
+						++pos;
+					m_token = m_text.substr(m_start, pos - m_start);
+					m_next = pos;
+				}
+
+				std::string_view m_text;
+				std::string_view m_token;
+				size_t m_start = 0; // m_text.size() once past the last token
+				size_t m_next = 0;
+			};
+
+			explicit token_range(std::string_view text) noexcept : m_text(text) {}
+
+			iterator begin() const noexcept
+			{
+				return iterator(m_text, 0);
+			}
+
+			iterator end() const noexcept
+			{
+				return iterator(m_text, m_text.size());
+			}
+		private:
+			std::string_view m_text;
+		};
+
+		// Scalar form of switch_keys, also used for the tails the vector kernels leave.
+		inline void switch_keys_scalar(const char* in, char* out, size_t size, morse_format old_fmt, morse_format new_fmt) noexcept
+		{
+			for (size_t i = 0; i < size; ++i)
 			{
+				char item = in[i];
 				if (item == old_fmt.long_press)
-					ss << new_fmt.long_press;
+					out[i] = new_fmt.long_press;
 				else if (item == old_fmt.short_press)
-					ss << new_fmt.short_press;
+					out[i] = new_fmt.short_press;
 				else if (item == old_fmt.space)
-					ss << new_fmt.space;
+					out[i] = new_fmt.space;
 				else
-					ss << item; // I believe this is the space. If not, the morse_text parameter is incorrect. Output also returns with the same error in the same place. Doesn't bother to repair. If you want to repair it, use repair_morse.
+					out[i] = item;
 			}
-			return ss.str();
 		}
 
-		static std::string switch_format(const std::string& morse_text, char old_fmt_lpk, char old_fmt_spk, char old_fmt_sk, char new_fmt_lpk, char new_fmt_spk, char new_fmt_sk)
+		// Scalar form of only_keys_and_whitespace.
+		inline bool only_keys_and_whitespace_scalar(const char* in, size_t size, morse_format fmt) noexcept
 		{
-			if (old_fmt_lpk == new_fmt_lpk && old_fmt_spk == new_fmt_spk && old_fmt_sk == new_fmt_sk)
-				return morse_text;
-			std::stringstream ss;
-			for (char item : morse_text)
+			for (size_t i = 0; i < size; ++i)
 			{
-				if (item == old_fmt_lpk)
-					ss << new_fmt_lpk;
-				else if (item == old_fmt_spk)
-					ss << new_fmt_spk;
-				else if (item == old_fmt_sk)
-					ss << new_fmt_sk;
-				else
-					ss << item;
+				char c = in[i];
+				if (!fmt.is_key(c) && c != ' ' && (c < '\t' || c > '\r'))
+					return false;
 			}
-			return ss.str();
+			return true;
 		}
 
-		/*
-		* @brief The remove_incorrect_letter and try_ordered_repair_list_one_by_one options are ignored in this list. 
-		* Other repair modes can be placed in any order. The user is free to choose which repair modes to include.
-		* 
-		*	Default order:
-		*	1- remove_incorrect_key
-		*	2- try_replacing_with_short_press
-		*	3- try_replacing_with_long_press
-		*/
-		static void set_repair_order(std::initializer_list<repair_mode> new_order)
+#ifdef THUG_HAS_X86_SIMD
+		inline bool cpu_has_avx2() noexcept
 		{
-			std::unordered_set<repair_mode> seen;
+			static const bool result = []()
+				{
+#if defined(_MSC_VER) && !defined(__clang__)
+					int info[4];
+					__cpuid(info, 0);
+					if (info[0] < 7)
+						return false;
+					__cpuid(info, 1);
+					bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+					__cpuidex(info, 7, 0);
+					return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+#else
+					return __builtin_cpu_supports("avx2") != 0;
+#endif
+				}();
+			return result;
+		}
 
-			s_repair_order.clear();
-			s_repair_order.reserve(new_order.size());
+		// The blends go from the lowest to the highest priority key, so a byte equal to several old keys ends up like in the scalar chain.
+		inline size_t switch_keys_sse2(const char* in, char* out, size_t size, morse_format old_fmt, morse_format new_fmt) noexcept
+		{
+			const __m128i old_long = _mm_set1_epi8(old_fmt.long_press), new_long = _mm_set1_epi8(new_fmt.long_press);
+			const __m128i old_short = _mm_set1_epi8(old_fmt.short_press), new_short = _mm_set1_epi8(new_fmt.short_press);
+			const __m128i old_space = _mm_set1_epi8(old_fmt.space), new_space = _mm_set1_epi8(new_fmt.space);
+			auto blend = [](__m128i mask, __m128i value, __m128i rest) { return _mm_or_si128(_mm_and_si128(mask, value), _mm_andnot_si128(mask, rest)); };
 
-			for (const auto& elem : new_order) 
-				if (seen.insert(elem).second) 
-					s_repair_order.push_back(elem);
+			size_t i = 0;
+			for (; i + 16 <= size; i += 16)
+			{
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+				__m128i r = blend(_mm_cmpeq_epi8(v, old_space), new_space, v);
+				r = blend(_mm_cmpeq_epi8(v, old_short), new_short, r);
+				r = blend(_mm_cmpeq_epi8(v, old_long), new_long, r);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), r);
+			}
+			return i;
 		}
 
-		static std::string repair_morse(const std::string& morse_text, repair_mode mode = repair_mode::default_mode, morse_format fmt = default_format)
+		THUG_TARGET_AVX2 inline size_t switch_keys_avx2(const char* in, char* out, size_t size, morse_format old_fmt, morse_format new_fmt) noexcept
 		{
-			auto parsed_text = detail::separate_string(morse_text);
-			if (parsed_text.empty())
-				return std::string();
-
-			auto key_list = get_valid_morse_list(fmt);
+			const __m256i old_long = _mm256_set1_epi8(old_fmt.long_press), new_long = _mm256_set1_epi8(new_fmt.long_press);
+			const __m256i old_short = _mm256_set1_epi8(old_fmt.short_press), new_short = _mm256_set1_epi8(new_fmt.short_press);
+			const __m256i old_space = _mm256_set1_epi8(old_fmt.space), new_space = _mm256_set1_epi8(new_fmt.space);
 
-			std::stringstream ss;
+			size_t i = 0;
+			for (; i + 32 <= size; i += 32)
+			{
+				__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+				__m256i r = _mm256_blendv_epi8(v, new_space, _mm256_cmpeq_epi8(v, old_space));
+				r = _mm256_blendv_epi8(r, new_short, _mm256_cmpeq_epi8(v, old_short));
+				r = _mm256_blendv_epi8(r, new_long, _mm256_cmpeq_epi8(v, old_long));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), r);
+			}
+			return i;
+		}
 
-			auto add_to_stream = [&](const std::string& letter, bool add_space)
-				{
-					ss << letter;
-					if (add_space)
-						ss << ' ';
-				};
+		// Whitespace is ' ' and the range '\t'..'\r'. The range check is an unsigned compare done with min.
+		inline size_t only_keys_and_whitespace_sse2(const char* in, size_t size, morse_format fmt, bool& valid) noexcept
+		{
+			const __m128i long_press = _mm_set1_epi8(fmt.long_press), short_press = _mm_set1_epi8(fmt.short_press), space = _mm_set1_epi8(fmt.space);
+			const __m128i blank = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), range = _mm_set1_epi8('\r' - '\t');
 
-			for (size_t i = 0; i < parsed_text.size(); ++i)
+			size_t i = 0;
+			for (; i + 16 <= size; i += 16)
 			{
-				if (std::find(key_list.begin(), key_list.end(), parsed_text[i]) == key_list.end())
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+				__m128i offset = _mm_sub_epi8(v, tab);
+				__m128i ok = _mm_cmpeq_epi8(_mm_min_epu8(offset, range), offset);
+				ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, blank));
+				ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, long_press));
+				ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, short_press));
+				ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, space));
+				if (_mm_movemask_epi8(ok) != 0xFFFF)
 				{
-					switch (mode)
-					{
-					case thug::repair_mode::remove_incorrect_letter:
-					{
-						break; // Just skip adding letters process.
-					}
-					case thug::repair_mode::remove_incorrect_key:
-					{
-						std::string fixed_letter = parsed_text[i];
-
-						// Let's remove irrelevant keys.
-						fixed_letter.erase(std::remove_if(fixed_letter.begin(), fixed_letter.end(),
-							[fmt](char c) {
-								return !fmt.is_key(c);
-							}),
-							fixed_letter.end());
-
-						if (std::find(key_list.begin(), key_list.end(), fixed_letter) == key_list.end())
-						{
-							break; // Still wrong, let's remove the letter.
-						}
-						else // The letter has been repaired. Let's add it.
-						{
-							add_to_stream(fixed_letter, i < parsed_text.size() - 1);
-						}
-						break;
-					}
-					case thug::repair_mode::try_replacing_with_short_press:
-					{
-						std::string fixed_letter = parsed_text[i];
-
-						// Let's replace the incorrect keys with short_press key
-						for (auto& key : fixed_letter)
-							if (!fmt.is_key(key))
-								key = fmt.short_press;
-
-						if (std::find(key_list.begin(), key_list.end(), fixed_letter) == key_list.end())
-						{
-							break; // Still wrong, let's remove the letter.
-						}
-						else // The letter has been repaired. Let's add it.
-						{
-							add_to_stream(fixed_letter, i < parsed_text.size() - 1);
-						}
-						break;
-					}
-					case thug::repair_mode::try_replacing_with_long_press:
-					{
-						std::string fixed_letter = parsed_text[i];
-
-						// Let's replace the incorrect keys with long_press key
-						for (auto& key : fixed_letter)
-							if (!fmt.is_key(key))
-								key = fmt.long_press;
-
-						if (std::find(key_list.begin(), key_list.end(), fixed_letter) == key_list.end())
-						{
-							break; // Still wrong, let's remove the letter.
-						}
-						else // The letter has been repaired. Let's add it.
-						{
-							add_to_stream(fixed_letter, i < parsed_text.size() - 1);
-						}
-						break;
-					}
-					case thug::repair_mode::try_ordered_repair_list_one_by_one:
-					{
-						bool exit_loop = false;
-						for (auto& rm : s_repair_order)
-						{
-							if (exit_loop)
-								break;
+					valid = false;
+					return i;
+				}
+			}
+			return i;
+		}
 
-							switch (rm)
-							{
-							case thug::repair_mode::remove_incorrect_key:
-							{
-								std::string fixed_letter = parsed_text[i];
-
-								// Let's remove irrelevant keys.
-								fixed_letter.erase(std::remove_if(fixed_letter.begin(), fixed_letter.end(),
-									[fmt](char c) {
-										return !fmt.is_key(c);
-									}),
-									fixed_letter.end());
-
-								if (std::find(key_list.begin(), key_list.end(), fixed_letter) == key_list.end())
-								{
-									break; // Still wrong, next mode.
-								}
-								else // The letter has been repaired. Let's add it.
-								{
-									add_to_stream(fixed_letter, i < parsed_text.size() - 1);
-									// we should exit the loop
-									exit_loop = true;
-								}
-								break;
-							}
-							case thug::repair_mode::try_replacing_with_short_press:
-							{
-								std::string fixed_letter = parsed_text[i];
-
-								// Let's replace the incorrect keys with short_press key
-								for (auto& key : fixed_letter)
-									if (!fmt.is_key(key))
-										key = fmt.short_press;
-
-								if (std::find(key_list.begin(), key_list.end(), fixed_letter) == key_list.end())
-								{
-									break; // Still wrong, next mode.
-								}
-								else // The letter has been repaired. Let's add it.
-								{
-									add_to_stream(fixed_letter, i < parsed_text.size() - 1);
-									// we should exit the loop
-									exit_loop = true;
-								}
-								break;
-							}
-							case thug::repair_mode::try_replacing_with_long_press:
-							{
-								std::string fixed_letter = parsed_text[i];
-
-								// Let's replace the incorrect keys with long_press key
-								for (auto& key : fixed_letter)
-									if (!fmt.is_key(key))
-										key = fmt.long_press;
-
-								if (std::find(key_list.begin(), key_list.end(), fixed_letter) == key_list.end())
-								{
-									break; // Still wrong, next mode.
-								}
-								else // The letter has been repaired. Let's add it.
-								{
-									add_to_stream(fixed_letter, i < parsed_text.size() - 1);
-									// we should exit the loop
-									exit_loop = true;
-								}
-								break;
-							}
-							default:
-								break;
-							}
-						}
-						break;
-					}
-					default:
-						break; // Same as remove_incorrect_letter, just skip adding letters process.
-					}
+		THUG_TARGET_AVX2 inline size_t only_keys_and_whitespace_avx2(const char* in, size_t size, morse_format fmt, bool& valid) noexcept
+		{
+			const __m256i long_press = _mm256_set1_epi8(fmt.long_press), short_press = _mm256_set1_epi8(fmt.short_press), space = _mm256_set1_epi8(fmt.space);
+			const __m256i blank = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), range = _mm256_set1_epi8('\r' - '\t');
 
-				}
-				else
+			size_t i = 0;
+			for (; i + 32 <= size; i += 32)
+			{
+				__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+				__m256i offset = _mm256_sub_epi8(v, tab);
+				__m256i ok = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, range), offset);
+				ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, blank));
+				ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, long_press));
+				ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, short_press));
+				ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, space));
+				if (_mm256_movemask_epi8(ok) != -1)
 				{
-					add_to_stream(parsed_text[i], i < parsed_text.size() - 1);
+					valid = false;
+					return i;
 				}
 			}
+			return i;
+		}
+#endif // THUG_HAS_X86_SIMD
 
-			return ss.str();
+		// Writes in with the keys of old_fmt replaced by the keys of new_fmt. Other bytes are copied as they are.
+		inline void switch_keys(const char* in, char* out, size_t size, morse_format old_fmt, morse_format new_fmt) noexcept
+		{
+			size_t done = 0;
+#ifdef THUG_HAS_X86_SIMD
+			if (cpu_has_avx2())
+				done = switch_keys_avx2(in, out, size, old_fmt, new_fmt);
+			else
+				done = switch_keys_sse2(in, out, size, old_fmt, new_fmt);
+#endif // THUG_HAS_X86_SIMD
+			switch_keys_scalar(in + done, out + done, size - done, old_fmt, new_fmt);
 		}
 
-		static bool is_valid_morse(const std::string& morse_text, morse_format fmt = default_format)
+		// Prescan for validation: a token with any other byte in it can't be a valid code.
+		inline bool only_keys_and_whitespace(std::string_view text, morse_format fmt) noexcept
 		{
-			auto parsed_text = detail::separate_string(morse_text);
-			if (parsed_text.empty())
-				return true;
+			size_t done = 0;
+			bool valid = true;
+#ifdef THUG_HAS_X86_SIMD
+			if (cpu_has_avx2())
+				done = only_keys_and_whitespace_avx2(text.data(), text.size(), fmt, valid);
+			else
+				done = only_keys_and_whitespace_sse2(text.data(), text.size(), fmt, valid);
+#endif // THUG_HAS_X86_SIMD
+			return valid && only_keys_and_whitespace_scalar(text.data() + done, text.size() - done, fmt);
+		}
 
-			auto key_list = get_valid_morse_list(fmt);
+		// Runs fn(0) .. fn(count - 1) on up to thread_count threads, the calling thread included. Indices are handed out one at a time.
+		template <typename Fn>
+		void parallel_for(size_t count, unsigned thread_count, Fn&& fn)
+		{
+			std::atomic<size_t> next{ 0 };
+			auto worker = [&]()
+				{
+					for (size_t i = next++; i < count; i = next++)
+						fn(i);
+				};
 
-			for (auto& letter : parsed_text)
-				if (std::find(key_list.begin(), key_list.end(), letter) == key_list.end())
-					return false;
+			// The counters of the other threads are handed back to the calling thread, as if it had done all the work.
+			THUG_STATS(conversion_stats gathered; std::mutex gathered_mutex;)
+			auto helper = [&]()
+				{
+					worker();
+					THUG_STATS(std::lock_guard<std::mutex> lock(gathered_mutex); gathered += thread_stats();)
+				};
 
-			return true;
+			std::vector<std::thread> threads;
+			size_t extra = std::min<size_t>(count, thread_count) > 0 ? std::min<size_t>(count, thread_count) - 1 : 0;
+			threads.reserve(extra);
+			for (size_t i = 0; i < extra; ++i)
+				threads.emplace_back(helper);
+			worker();
+			for (auto& thread : threads)
+				thread.join();
+			THUG_STATS(thread_stats() += gathered;)
 		}
-	private:
-		static std::unordered_map<char, std::string> get_key_table(morse_format fmt)
-		{
-			std::unordered_map<char, std::string> result;
-
-			result['a'] = switch_format(".-", default_format, fmt);
-			result['b'] = switch_format("-...", default_format, fmt);
-			result['c'] = switch_format("-.-.", default_format, fmt);
-			result['d'] = switch_format("-..", default_format, fmt);
-			result['e'] = switch_format(".", default_format, fmt);
-			result['f'] = switch_format("..-.", default_format, fmt);
-			result['g'] = switch_format("--.", default_format, fmt);
-			result['h'] = switch_format("....", default_format, fmt);
-			result['i'] = switch_format("..", default_format, fmt);
-			result['j'] = switch_format(".---", default_format, fmt);
-			result['k'] = switch_format("-.-", default_format, fmt);
-			result['l'] = switch_format(".-..", default_format, fmt);
-			result['m'] = switch_format("--", default_format, fmt);
-			result['n'] = switch_format("-.", default_format, fmt);
-			result['o'] = switch_format("---", default_format, fmt);
-			result['p'] = switch_format(".--.", default_format, fmt);
-			result['q'] = switch_format("--.-", default_format, fmt);
-			result['r'] = switch_format(".-.", default_format, fmt);
-			result['s'] = switch_format("...", default_format, fmt);
-			result['t'] = switch_format("-", default_format, fmt);
-			result['u'] = switch_format("..-", default_format, fmt);
-			result['v'] = switch_format("...-", default_format, fmt);
-			result['w'] = switch_format(".--", default_format, fmt);
-			result['x'] = switch_format("-..-", default_format, fmt);
-			result['y'] = switch_format("-.--", default_format, fmt);
-			result['z'] = switch_format("--..", default_format, fmt);
-			result['0'] = switch_format("-----", default_format, fmt);
-			result['1'] = switch_format(".----", default_format, fmt);
-			result['2'] = switch_format("..---", default_format, fmt);
-			result['3'] = switch_format("...--", default_format, fmt);
-			result['4'] = switch_format("....-", default_format, fmt);
-			result['5'] = switch_format(".....", default_format, fmt);
-			result['6'] = switch_format("-....", default_format, fmt);
-			result['7'] = switch_format("--...", default_format, fmt);
-			result['8'] = switch_format("---..", default_format, fmt);
-			result['9'] = switch_format("----.", default_format, fmt);
-			result['.'] = switch_format(".-.-.-", default_format, fmt);
-			result[','] = switch_format("--..--", default_format, fmt);
-			result['?'] = switch_format("..--..", default_format, fmt);
-			result['/'] = switch_format("-..-.", default_format, fmt);
-			result['('] = switch_format("-.--.", default_format, fmt);
-			result[')'] = switch_format("-.--.-", default_format, fmt);
-			result[':'] = switch_format("---...", default_format, fmt);
-			result['='] = switch_format("-...-", default_format, fmt);
-			result['+'] = switch_format(".-.-.", default_format, fmt);
-			result['-'] = switch_format("-....-", default_format, fmt);
-			result['@'] = switch_format(".--.-.", default_format, fmt);
-			result['\''] = switch_format(".----.", default_format, fmt);
-			result['\"'] = switch_format(".-..-.", default_format, fmt);
-			result['\\'] = switch_format("-..-.", default_format, fmt);
-
-			result[' '] = fmt.space;
-
-			// these are nonstandart
-			result['!'] = switch_format("-.-.--", default_format, fmt);
-			result['&'] = switch_format(".-...", default_format, fmt);
-			result[';'] = switch_format("-.-.-.", default_format, fmt);
-			result['_'] = switch_format("..--.-", default_format, fmt);
-			result['$'] = switch_format("...-..-", default_format, fmt);
-			
-			return result;
-		}
-
-		static std::vector<std::string> get_valid_morse_list(morse_format fmt)
-		{
-			std::vector<std::string> result;
-
-			result.reserve(56); // sizeof letters
-
-			result.push_back(switch_format(".-", default_format, fmt));
-			result.push_back(switch_format("-...", default_format, fmt));
-			result.push_back(switch_format("-.-.", default_format, fmt));
-			result.push_back(switch_format("-..", default_format, fmt));
-			result.push_back(switch_format(".", default_format, fmt));
-			result.push_back(switch_format("..-.", default_format, fmt));
-			result.push_back(switch_format("--.", default_format, fmt));
-			result.push_back(switch_format("....", default_format, fmt));
-			result.push_back(switch_format("..", default_format, fmt));
-			result.push_back(switch_format(".---", default_format, fmt));
-			result.push_back(switch_format("-.-", default_format, fmt));
-			result.push_back(switch_format(".-..", default_format, fmt));
-			result.push_back(switch_format("--", default_format, fmt));
-			result.push_back(switch_format("-.", default_format, fmt));
-			result.push_back(switch_format("---", default_format, fmt));
-			result.push_back(switch_format(".--.", default_format, fmt));
-			result.push_back(switch_format("--.-", default_format, fmt));
-			result.push_back(switch_format(".-.", default_format, fmt));
-			result.push_back(switch_format("...", default_format, fmt));
-			result.push_back(switch_format("-", default_format, fmt));
-			result.push_back(switch_format("..-", default_format, fmt));
-			result.push_back(switch_format("...-", default_format, fmt));
-			result.push_back(switch_format(".--", default_format, fmt));
-			result.push_back(switch_format("-..-", default_format, fmt));
-			result.push_back(switch_format("-.--", default_format, fmt));
-			result.push_back(switch_format("--..", default_format, fmt));
-			result.push_back(switch_format("-----", default_format, fmt));
-			result.push_back(switch_format(".----", default_format, fmt));
-			result.push_back(switch_format("..---", default_format, fmt));
-			result.push_back(switch_format("...--", default_format, fmt));
-			result.push_back(switch_format("....-", default_format, fmt));
-			result.push_back(switch_format(".....", default_format, fmt));
-			result.push_back(switch_format("-....", default_format, fmt));
-			result.push_back(switch_format("--...", default_format, fmt));
-			result.push_back(switch_format("---..", default_format, fmt));
-			result.push_back(switch_format("----.", default_format, fmt));
-			result.push_back(switch_format(".-.-.-", default_format, fmt));
-			result.push_back(switch_format("--..--", default_format, fmt));
-			result.push_back(switch_format("..--..", default_format, fmt));
-			result.push_back(switch_format("-..-.", default_format, fmt));
-			result.push_back(switch_format("-.--.", default_format, fmt));
-			result.push_back(switch_format("-.--.-", default_format, fmt));
-			result.push_back(switch_format("---...", default_format, fmt));
-			result.push_back(switch_format("-...-", default_format, fmt));
-			result.push_back(switch_format(".-.-.", default_format, fmt));
-			result.push_back(switch_format("-....-", default_format, fmt));
-			result.push_back(switch_format(".--.-.", default_format, fmt));
-			result.push_back(switch_format(".----.", default_format, fmt));
-			result.push_back(switch_format(".-..-.", default_format, fmt));
-			result.push_back(switch_format("-..-.", default_format, fmt));
-
-			result.push_back(std::string(1, fmt.space));
+	}
 
-			// these are nonstandart
-			result.push_back(switch_format("-.-.--", default_format, fmt));
-			result.push_back(switch_format(".-...", default_format, fmt));
-			result.push_back(switch_format("-.-.-.", default_format, fmt));
-			result.push_back(switch_format("..--.-", default_format, fmt));
-			result.push_back(switch_format("...-..-", default_format, fmt));
+	struct morse_alphabet_entry
+	{
+		char32_t letter;
+		const char* code; // written in default_format
+	};
 
-			return result;
+	/*
+	* @brief Maps the code points of a script to morse codes and back. Built at compile time by make_morse_alphabet.
+	* Encoding finds a code point with a perfect hash (hash and displace): the code point picks a bucket, the bucket's seed picks the slot,
+	* and no two keys share a slot, so a lookup is two multiplies and one compare. ASCII has a direct table on top.
+	* Decoding indexes letters by packed code, like the built-in table does.
+	*/
+	struct morse_alphabet
+	{
+		static constexpr size_t max_keys = 192; // letters and their upper case forms
+		static constexpr size_t slot_bits = 9;
+		static constexpr size_t bucket_bits = 6;
+
+		uint8_t ascii[128] = {}; // packed code by byte, 0 means no letter
+		uint16_t seeds[size_t(1) << bucket_bits] = {};
+		char32_t keys[size_t(1) << slot_bits] = {};
+		uint8_t codes[size_t(1) << slot_bits] = {}; // 0 marks a free slot, packed codes are never 0
+		char32_t letters[256] = {}; // by packed code, 0 means that no letter has this code
+		uint8_t max_utf8_size = 1; // longest UTF-8 form of a letter, for sizing decode output
+
+		static constexpr size_t bucket_of(char32_t c) noexcept
+		{
+			return static_cast<size_t>(static_cast<uint32_t>(c * 0x85EBCA77u) >> (32 - bucket_bits));
 		}
 
-		static std::vector<repair_mode> s_repair_order;
-		std::unordered_map<char, std::string> m_keys;
-		morse_format m_format;
-		};
+		static constexpr size_t slot_of(char32_t c, uint16_t seed) noexcept
+		{
+			return static_cast<size_t>(static_cast<uint32_t>((c ^ seed) * 0x9E3779B1u) >> (32 - slot_bits));
+		}
 
-		std::vector<repair_mode> morse_converter::s_repair_order = 
-		{ 
-			repair_mode::remove_incorrect_key,
-			repair_mode::try_replacing_with_short_press,
-			repair_mode::try_replacing_with_long_press,
+		// Returns the packed code of a letter, or 0 if the alphabet doesn't have it.
+		constexpr uint8_t find(char32_t c) const noexcept
+		{
+			if (c < 128)
+				return ascii[c];
+			size_t slot = slot_of(c, seeds[bucket_of(c)]);
+			return keys[slot] == c ? codes[slot] : 0;
+		}
+	};
+
+	namespace detail
+	{
+		constexpr char32_t to_code_point(char c) noexcept
+		{
+			return static_cast<uint8_t>(c);
+		}
+
+		constexpr char32_t to_code_point(char32_t c) noexcept
+		{
+			return c;
+		}
+
+		// Upper case forms of Latin-1, Greek and Cyrillic lower case letters, so encode is case insensitive like the ASCII path.
+		constexpr char32_t simple_upper(char32_t c) noexcept
+		{
+			if ((c >= U'a' && c <= U'z') || (c >= 0xE0 && c <= 0xFE && c != 0xF7) || (c >= 0x3B1 && c <= 0x3C9 && c != 0x3C2) || (c >= 0x430 && c <= 0x44F))
+				return c - 0x20;
+			if (c >= 0x450 && c <= 0x45F)
+				return c - 0x50;
+			return c;
+		}
+
+		constexpr uint8_t utf8_size(char32_t c) noexcept
+		{
+			return c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+		}
+
+		// Entries whose code is longer than max_code_length, or whose letter is already taken, are left out.
+		template <typename Entry, size_t N>
+		constexpr morse_alphabet build_alphabet(const Entry(&entries)[N]) noexcept
+		{
+			static_assert(N * 2 <= morse_alphabet::max_keys, "too many letters for one alphabet");
+			constexpr size_t bucket_count = size_t(1) << morse_alphabet::bucket_bits;
+
+			morse_alphabet result{};
+			char32_t keys[morse_alphabet::max_keys] = {};
+			uint8_t codes[morse_alphabet::max_keys] = {};
+			size_t key_count = 0;
+			auto add_key = [&](char32_t key, uint8_t code)
+				{
+					for (size_t i = 0; i < key_count; ++i)
+						if (keys[i] == key)
+							return;
+					keys[key_count] = key;
+					codes[key_count++] = code;
+				};
+
+			for (const auto& entry : entries)
+			{
+				size_t length = 0;
+				while (entry.code[length] != '\0')
+					++length;
+				if (length > max_code_length)
+					continue;
+
+				char32_t letter = to_code_point(entry.letter);
+				uint8_t code = pack_code(entry.code);
+				add_key(letter, code);
+				add_key(simple_upper(letter), code);
+				if (result.letters[code] == 0)
+				{
+					result.letters[code] = letter;
+					result.max_utf8_size = std::max(result.max_utf8_size, utf8_size(letter));
+				}
+			}
+
+			// Keys above ASCII are grouped by bucket: bucket b owns members[starts[b]] .. members[starts[b + 1] - 1].
+			size_t starts[bucket_count + 1] = {};
+			for (size_t i = 0; i < key_count; ++i)
+			{
+				if (keys[i] < 128)
+					result.ascii[keys[i]] = codes[i];
+				else
+					++starts[morse_alphabet::bucket_of(keys[i]) + 1];
+			}
+			for (size_t bucket = 0; bucket < bucket_count; ++bucket)
+				starts[bucket + 1] += starts[bucket];
+			size_t members[morse_alphabet::max_keys] = {};
+			size_t filled[bucket_count] = {};
+			for (size_t i = 0; i < key_count; ++i)
+			{
+				if (keys[i] >= 128)
+				{
+					size_t bucket = morse_alphabet::bucket_of(keys[i]);
+					members[starts[bucket] + filled[bucket]++] = i;
+				}
+			}
+
+			// Largest buckets first, while most slots are still free. Each one tries seeds until its keys land on free, distinct slots.
+			for (size_t size = morse_alphabet::max_keys; size > 0; --size)
+			{
+				for (size_t bucket = 0; bucket < bucket_count; ++bucket)
+				{
+					if (starts[bucket + 1] - starts[bucket] != size)
+						continue;
+					for (uint32_t seed = 0; seed <= 0xFFFF; ++seed)
+					{
+						size_t slots[morse_alphabet::max_keys] = {};
+						size_t placed = 0;
+						for (; placed < size; ++placed)
+						{
+							size_t slot = morse_alphabet::slot_of(keys[members[starts[bucket] + placed]], static_cast<uint16_t>(seed));
+							bool free = result.codes[slot] == 0;
+							for (size_t k = 0; k < placed && free; ++k)
+								free = slots[k] != slot;
+							if (!free)
+								break;
+							slots[placed] = slot;
+						}
+						if (placed != size)
+							continue;
+
+						result.seeds[bucket] = static_cast<uint16_t>(seed);
+						for (size_t k = 0; k < size; ++k)
+						{
+							result.keys[slots[k]] = keys[members[starts[bucket] + k]];
+							result.codes[slots[k]] = codes[members[starts[bucket] + k]];
+						}
+						break;
+					}
+				}
+			}
+			return result;
+		}
+	}
+
+	// Builds an alphabet from letters and their codes. Upper case forms are added for Latin, Greek and Cyrillic letters.
+	// When two letters share a code, decoding picks the one that comes first.
+	template <size_t N>
+	constexpr morse_alphabet make_morse_alphabet(const morse_alphabet_entry(&entries)[N]) noexcept
+	{
+		return detail::build_alphabet(entries);
+	}
+
+	// Letters are written as escapes, so the header doesn't depend on the source encoding the compiler assumes.
+	namespace detail
+	{
+		constexpr morse_alphabet_entry cyrillic_code_table[] =
+		{
+			{ U'\u0430', ".-" }, { U'\u0431', "-..." }, { U'\u0432', ".--" }, { U'\u0433', "--." }, { U'\u0434', "-.." }, { U'\u0435', "." }, { U'\u0451', "." },
+			{ U'\u0436', "...-" }, { U'\u0437', "--.." }, { U'\u0438', ".." }, { U'\u0439', ".---" }, { U'\u043A', "-.-" }, { U'\u043B', ".-.." }, { U'\u043C', "--" },
+			{ U'\u043D', "-." }, { U'\u043E', "---" }, { U'\u043F', ".--." }, { U'\u0440', ".-." }, { U'\u0441', "..." }, { U'\u0442', "-" }, { U'\u0443', "..-" },
+			{ U'\u0444', "..-." }, { U'\u0445', "...." }, { U'\u0446', "-.-." }, { U'\u0447', "---." }, { U'\u0448', "----" }, { U'\u0449', "--.-" }, { U'\u044A', "--.--" },
+			{ U'\u044B', "-.--" }, { U'\u044C', "-..-" }, { U'\u044D', "..-.." }, { U'\u044E', "..--" }, { U'\u044F', ".-.-" },
+			{ U'0', "-----" }, { U'1', ".----" }, { U'2', "..---" }, { U'3', "...--" }, { U'4', "....-" },
+			{ U'5', "....." }, { U'6', "-...." }, { U'7', "--..." }, { U'8', "---.." }, { U'9', "----." },
+			{ U'.', "......" }, { U',', ".-.-.-" }, { U'?', "..--.." }, { U'!', "--..--" }, { U'-', "-....-" }, { U'/', "-..-." },
+			{ U'(', "-.--.-" }, { U')', "-.--.-" }, { U':', "---..." }, { U';', "-.-.-." }, { U'=', "-...-" }, { U'\'', ".----." },
+			{ U'\"', ".-..-." }, { U'@', ".--.-." },
+			{ U' ', "" },
+		};
+
+		constexpr morse_alphabet_entry greek_code_table[] =
+		{
+			{ U'\u03B1', ".-" }, { U'\u03B2', "-..." }, { U'\u03B3', "--." }, { U'\u03B4', "-.." }, { U'\u03B5', "." }, { U'\u03B6', "--.." }, { U'\u03B7', "...." },
+			{ U'\u03B8', "-.-." }, { U'\u03B9', ".." }, { U'\u03BA', "-.-" }, { U'\u03BB', ".-.." }, { U'\u03BC', "--" }, { U'\u03BD', "-." }, { U'\u03BE', "-..-" },
+			{ U'\u03BF', "---" }, { U'\u03C0', ".--." }, { U'\u03C1', ".-." }, { U'\u03C3', "..." }, { U'\u03C2', "..." }, { U'\u03C4', "-" }, { U'\u03C5', "-.--" },
+			{ U'\u03C6', "..-." }, { U'\u03C7', "----" }, { U'\u03C8', "--.-" }, { U'\u03C9', ".--" },
+			{ U'\u03AC', ".-" }, { U'\u03AD', "." }, { U'\u03AE', "...." }, { U'\u03AF', ".." }, { U'\u03CC', "---" }, { U'\u03CD', "-.--" }, { U'\u03CE', ".--" }, // with tonos
+			{ U'0', "-----" }, { U'1', ".----" }, { U'2', "..---" }, { U'3', "...--" }, { U'4', "....-" },
+			{ U'5', "....." }, { U'6', "-...." }, { U'7', "--..." }, { U'8', "---.." }, { U'9', "----." },
+			{ U'.', ".-.-.-" }, { U',', "--..--" }, { U'?', "..--.." }, { U'/', "-..-." }, { U'(', "-.--." }, { U')', "-.--.-" },
+			{ U':', "---..." }, { U'=', "-...-" }, { U'+', ".-.-." }, { U'-', "-....-" }, { U'@', ".--.-." }, { U'\'', ".----." },
+			{ U'\"', ".-..-." },
+			{ U' ', "" },
+		};
+
+		// Voiced and semi-voiced kana are written as the plain kana followed by a separate mark (U+309B or U+309C).
+		constexpr morse_alphabet_entry wabun_code_table[] =
+		{
+			{ U'\u30A4', ".-" }, { U'\u30ED', ".-.-" }, { U'\u30CF', "-..." }, { U'\u30CB', "-.-." }, { U'\u30DB', "-.." }, { U'\u30D8', "." }, { U'\u30C8', "..-.." },
+			{ U'\u30C1', "..-." }, { U'\u30EA', "--." }, { U'\u30CC', "...." }, { U'\u30EB', "-.--." }, { U'\u30F2', ".---" }, { U'\u30EF', "-.-" }, { U'\u30AB', ".-.." },
+			{ U'\u30E8', "--" }, { U'\u30BF', "-." }, { U'\u30EC', "---" }, { U'\u30BD', "---." }, { U'\u30C4', ".--." }, { U'\u30CD', "--.-" }, { U'\u30CA', ".-." },
+			{ U'\u30E9', "..." }, { U'\u30E0', "-" }, { U'\u30A6', "..-" }, { U'\u30F0', ".-..-" }, { U'\u30CE', "..--" }, { U'\u30AA', ".-..." }, { U'\u30AF', "...-" },
+			{ U'\u30E4', ".--" }, { U'\u30DE', "-..-" }, { U'\u30B1', "-.--" }, { U'\u30D5', "--.." }, { U'\u30B3', "----" }, { U'\u30A8', "-.---" }, { U'\u30C6', ".-.--" },
+			{ U'\u30A2', "--.--" }, { U'\u30B5', "-.-.-" }, { U'\u30AD', "-.-.." }, { U'\u30E6', "-..--" }, { U'\u30E1', "-...-" }, { U'\u30DF', "..-.-" },
+			{ U'\u30B7', "--.-." }, { U'\u30F1', ".--.." }, { U'\u30D2', "--..-" }, { U'\u30E2', "-..-." }, { U'\u30BB', ".---." }, { U'\u30B9', "---.-" },
+			{ U'\u30F3', ".-.-." }, { U'\u309B', ".." }, { U'\u309C', "..--." }, { U'\u30FC', ".--.-" }, { U'\u3001', ".-.-.-" },
+			{ U'0', "-----" }, { U'1', ".----" }, { U'2', "..---" }, { U'3', "...--" }, { U'4', "....-" },
+			{ U'5', "....." }, { U'6', "-...." }, { U'7', "--..." }, { U'8', "---.." }, { U'9', "----." },
+			{ U' ', "" },
+		};
+	}
+
+	inline constexpr morse_alphabet latin_alphabet = detail::build_alphabet(detail::morse_code_table);
+	inline constexpr morse_alphabet cyrillic_alphabet = detail::build_alphabet(detail::cyrillic_code_table);
+	inline constexpr morse_alphabet greek_alphabet = detail::build_alphabet(detail::greek_code_table);
+	inline constexpr morse_alphabet wabun_alphabet = detail::build_alphabet(detail::wabun_code_table);
+
+	namespace detail
+	{
+		// The keys of every packed code in one format, so alphabets can share a single per-format table.
+		struct packed_code_table
+		{
+			code_string codes[256] = {}; // by packed code, codes[0] is empty
+		};
+
+		constexpr packed_code_table make_packed_code_table(morse_format fmt) noexcept
+		{
+			packed_code_table result{};
+			result.codes[1].keys[result.codes[1].size++] = fmt.space;
+			for (unsigned packed = 2; packed < 256; ++packed)
+			{
+				size_t length = 0;
+				while ((packed >> (length + 1)) != 0)
+					++length;
+				auto& code = result.codes[packed];
+				for (size_t k = length; k-- > 0;)
+					code.keys[code.size++] = ((packed >> k) & 1u) ? fmt.long_press : fmt.short_press;
+			}
+			return result;
+		}
+
+		// Calls fn with the packed code of every code point of UTF-8 text, 0 for letters the alphabet lacks. A byte that doesn't start a
+		// well-formed sequence counts as one unknown letter, so broken input still yields one code per byte as in the ASCII path.
+		template <typename Fn>
+		void for_each_letter_code(std::string_view text, const morse_alphabet& alphabet, Fn&& fn)
+		{
+			const auto* in = reinterpret_cast<const uint8_t*>(text.data());
+			size_t size = text.size();
+			for (size_t i = 0; i < size;)
+			{
+				uint8_t lead = in[i];
+				if (lead < 0x80)
+				{
+					fn(alphabet.ascii[lead]);
+					++i;
+					continue;
+				}
+
+				size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 ? 2 : 0;
+				if (length == 0 || lead > 0xF4 || i + length > size)
+				{
+					fn(0);
+					++i;
+					continue;
+				}
+				char32_t c = lead & (0x7Fu >> length);
+				size_t k = 1;
+				for (; k < length && (in[i + k] & 0xC0) == 0x80; ++k)
+					c = (c << 6) | (in[i + k] & 0x3Fu);
+				if (k != length)
+				{
+					fn(0);
+					++i;
+					continue;
+				}
+				fn(alphabet.find(c));
+				i += length;
+			}
+		}
+
+		inline size_t encoded_size(std::string_view text, const morse_alphabet& alphabet, const packed_code_table& table) noexcept
+		{
+			size_t size = 0, letters = 0;
+			for_each_letter_code(text, alphabet, [&](uint8_t code)
+				{
+					size += table.codes[code].size;
+					++letters;
+				});
+			return letters != 0 ? size + letters - 1 : 0;
+		}
+
+		// out must have room for encoded_size(text, alphabet, table) bytes. Returns the end of the written output.
+		template <typename OutputIt>
+		OutputIt encode_to(std::string_view text, const morse_alphabet& alphabet, const packed_code_table& table, OutputIt out)
+		{
+			THUG_STATS_TIMER(conversion_stage::encode);
+			THUG_STATS(size_t written = 0, letters = 0, dropped = 0;)
+			bool first = true;
+			for_each_letter_code(text, alphabet, [&](uint8_t code)
+				{
+					if (!first)
+						*out++ = ' ';
+					first = false;
+					const auto& keys = table.codes[code];
+					for (uint8_t k = 0; k < keys.size; ++k)
+						*out++ = keys.keys[k];
+					THUG_STATS(written += keys.size; ++letters; dropped += code == 0;)
+				});
+			THUG_STATS(auto& stats = thread_stats(); stats.bytes_in += text.size(); stats.letters += letters; stats.dropped_letters += dropped;)
+			THUG_STATS(stats.bytes_out += letters == 0 ? 0 : written + letters - 1;)
+			return out;
+		}
+
+		template <typename OutputIt>
+		OutputIt append_utf8(char32_t c, OutputIt out)
+		{
+			if (c < 0x80)
+			{
+				*out++ = static_cast<char>(c);
+			}
+			else if (c < 0x800)
+			{
+				*out++ = static_cast<char>(0xC0 | (c >> 6));
+				*out++ = static_cast<char>(0x80 | (c & 0x3F));
+			}
+			else if (c < 0x10000)
+			{
+				*out++ = static_cast<char>(0xE0 | (c >> 12));
+				*out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+				*out++ = static_cast<char>(0x80 | (c & 0x3F));
+			}
+			else
+			{
+				*out++ = static_cast<char>(0xF0 | (c >> 18));
+				*out++ = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+				*out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+				*out++ = static_cast<char>(0x80 | (c & 0x3F));
+			}
+			return out;
+		}
+
+		// out must have room for decoded_size_upper_bound(morse) * alphabet.max_utf8_size bytes. Returns the end of the written output.
+		template <typename OutputIt>
+		OutputIt decode_to(std::string_view morse, const key_class_table& classes, const morse_alphabet& alphabet, OutputIt out)
+		{
+			THUG_STATS_TIMER(conversion_stage::decode);
+			THUG_STATS(size_t written = 0, tokens = 0, unknown = 0;)
+			for_each_token_code(morse, classes, [&](uint8_t code)
+				{
+					char32_t letter = alphabet.letters[code];
+					if (letter != 0)
+						out = append_utf8(letter, out);
+					THUG_STATS(++tokens; unknown += letter == 0; written += letter != 0 ? utf8_size(letter) : 0;)
+				});
+			THUG_STATS(auto& stats = thread_stats(); stats.bytes_in += morse.size(); stats.bytes_out += written; stats.tokens += tokens; stats.unknown_tokens += unknown;)
+			return out;
+		}
+	}
+
+	namespace detail
+	{
+		/*
+		* Binary morse: a 16 byte header followed by 2 bit symbols, four to a byte with the first symbol in the low bits.
+		* Header: the magic "THGM", a version byte, three zero bytes and the symbol count as a little endian 64 bit number.
+		* The symbols are short press, long press, space key and separator, so any morse that decode reads keeps its meaning,
+		* whatever the format, in a quarter of the size. A separator stands for one whitespace byte.
+		*/
+		constexpr char binary_magic[4] = { 'T', 'H', 'G', 'M' };
+		constexpr uint8_t binary_version = 1;
+		constexpr size_t binary_header_size = 16;
+
+		enum binary_symbol : uint8_t
+		{
+			binary_short_press = 0,
+			binary_long_press = 1,
+			binary_space = 2,
+			binary_separator = 3,
+			binary_invalid = 0xFF
+		};
+
+		// By key_class, so text is packed with the classes the format already has.
+		constexpr uint8_t binary_symbol_of[] = { binary_invalid, binary_short_press, binary_long_press, binary_space, binary_separator };
+
+		constexpr size_t binary_payload_size(uint64_t symbols) noexcept
+		{
+			return static_cast<size_t>((symbols + 3) / 4);
+		}
+
+		inline void store_le64(char* out, uint64_t value) noexcept
+		{
+			for (int i = 0; i < 8; ++i)
+				out[i] = static_cast<char>(value >> (8 * i));
+		}
+
+		inline uint64_t load_le64(const char* in, size_t size = 8) noexcept
+		{
+			uint64_t value = 0;
+			for (size_t i = 0; i < size; ++i)
+				value |= static_cast<uint64_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+			return value;
+		}
+
+		inline void write_binary_header(char* out, uint64_t symbols) noexcept
+		{
+			std::memcpy(out, binary_magic, 4);
+			out[4] = static_cast<char>(binary_version);
+			out[5] = out[6] = out[7] = 0;
+			store_le64(out + 8, symbols);
+		}
+
+		// Returns false if binary doesn't start with a header this version reads or is shorter than the header says.
+		inline bool read_binary_header(std::string_view binary, uint64_t& symbols) noexcept
+		{
+			if (binary.size() < binary_header_size || std::memcmp(binary.data(), binary_magic, 4) != 0 || static_cast<uint8_t>(binary[4]) != binary_version)
+				return false;
+			symbols = load_le64(binary.data() + 8);
+			return symbols <= static_cast<uint64_t>(binary.size() - binary_header_size) * 4;
+		}
+
+		// Collects symbols into 64 bit words and stores each word as soon as it is full. out needs 8 bytes of slack past the payload.
+		class binary_writer
+		{
+		public:
+			explicit binary_writer(char* out) noexcept : m_out(out) {}
+
+			// Appends up to 16 symbols, the first one in the low bits.
+			void put(uint32_t symbols, unsigned count) noexcept
+			{
+				m_word |= static_cast<uint64_t>(symbols) << (2 * m_fill);
+				m_fill += count;
+				if (m_fill >= 32)
+				{
+					store_le64(m_out, m_word);
+					m_out += 8;
+					m_fill -= 32;
+					m_word = m_fill != 0 ? static_cast<uint64_t>(symbols) >> (2 * (count - m_fill)) : 0;
+				}
+			}
+
+			void flush() noexcept
+			{
+				if (m_fill != 0)
+					store_le64(m_out, m_word);
+			}
+		private:
+			char* m_out;
+			uint64_t m_word = 0;
+			unsigned m_fill = 0;
+		};
+
+		// The symbols of every packed code followed by a separator, first symbol in the low bits. Unknown letters (code 0) are a lone separator.
+		struct binary_code
+		{
+			uint16_t symbols = binary_separator;
+			uint8_t count = 1;
+		};
+
+		struct binary_code_table
+		{
+			binary_code codes[256] = {};
+		};
+
+		constexpr binary_code_table make_binary_code_table() noexcept
+		{
+			binary_code_table result{};
+			result.codes[1] = { static_cast<uint16_t>(binary_space | binary_separator << 2), 2 };
+			for (unsigned packed = 2; packed < 256; ++packed)
+			{
+				unsigned length = 0;
+				while ((packed >> (length + 1)) != 0)
+					++length;
+				unsigned symbols = 0;
+				for (unsigned k = 0; k < length; ++k)
+					symbols |= ((packed >> (length - 1 - k)) & 1u) << (2 * k);
+				symbols |= binary_separator << (2 * length);
+				result.codes[packed] = { static_cast<uint16_t>(symbols), static_cast<uint8_t>(length + 1) };
+			}
+			return result;
+		}
+
+		inline constexpr binary_code_table binary_codes = make_binary_code_table();
+
+		// Symbols of encoding text with alphabet: every letter yields its code and a separator, except that the last separator is left out.
+		inline uint64_t binary_symbol_count(std::string_view text, const morse_alphabet& alphabet) noexcept
+		{
+			uint64_t symbols = 0;
+			for_each_letter_code(text, alphabet, [&](uint8_t code) { symbols += binary_codes.codes[code].count; });
+			return symbols != 0 ? symbols - 1 : 0;
+		}
+
+		// Each byte of packed symbols unpacked into four keys of a format.
+		struct binary_key_table
+		{
+			char keys[256][4] = {};
+		};
+
+		constexpr binary_key_table make_binary_key_table(morse_format fmt) noexcept
+		{
+			const char symbol_keys[4] = { fmt.short_press, fmt.long_press, fmt.space, ' ' };
+			binary_key_table result{};
+			for (unsigned byte = 0; byte < 256; ++byte)
+				for (unsigned k = 0; k < 4; ++k)
+					result.keys[byte][k] = symbol_keys[(byte >> (2 * k)) & 3u];
+			return result;
+		}
+	}
+
+	struct parallel_options
+	{
+		size_t min_chunk_size = size_t(1) << 20; // inputs are cut into chunks of at least this many bytes, so small ones stay serial
+		unsigned thread_count = 0; // 0 means std::thread::hardware_concurrency()
+
+		size_t chunk_count(size_t input_size) const noexcept
+		{
+			unsigned threads = thread_count != 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency());
+			size_t chunks = min_chunk_size != 0 ? input_size / min_chunk_size : input_size;
+			return std::max<size_t>(1, std::min<size_t>(chunks, threads));
+		}
+	};
+
+	namespace detail
+	{
+		// Everything a format needs for converting and validating. Built once per format and never changed afterwards.
+		struct morse_tables
+		{
+			morse_format format;
+			encode_table encode;
+			key_class_table key_classes;
+			packed_code_table packed_codes; // for encoding with alphabets
+			binary_key_table binary_keys; // for unpacking binary morse
+
+			explicit morse_tables(morse_format fmt) noexcept
+				: format(fmt), encode(make_encode_table(fmt)), key_classes(make_key_class_table(fmt)), packed_codes(make_packed_code_table(fmt)), binary_keys(make_binary_key_table(fmt)) {}
+
+			// Returns the letter of a single token, or '\0' if the token is not a valid code.
+			char decode_token(std::string_view token) const noexcept
+			{
+				token_decoder decoder;
+				for (char c : token)
+					decoder.push(key_classes[c]);
+				return decoder.finish();
+			}
+
+			bool is_valid(std::string_view token) const noexcept
+			{
+				return decode_token(token) != '\0';
+			}
+		};
+
+		using morse_tables_handle = std::shared_ptr<const morse_tables>;
+
+		/*
+		* @brief Returns the shared tables of a format, building them on first use. Safe to call from any thread.
+		* Entries are never evicted. Programs use a handful of formats, and each entry is about 5.5 KiB.
+		*/
+		inline morse_tables_handle get_tables(morse_format fmt)
+		{
+			if (fmt == default_format)
+			{
+				static const morse_tables_handle default_tables = std::make_shared<const morse_tables>(default_format);
+				return default_tables;
+			}
+
+			static std::mutex cache_mutex;
+			static std::unordered_map<uint32_t, morse_tables_handle> cache;
+
+			uint32_t key = static_cast<uint32_t>(static_cast<uint8_t>(fmt.long_press)) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(fmt.short_press)) << 8 | static_cast<uint8_t>(fmt.space);
+			std::lock_guard<std::mutex> lock(cache_mutex);
+			auto& tables = cache[key];
+			if (!tables)
+				tables = std::make_shared<const morse_tables>(fmt);
+			return tables;
+		}
+	}
+
+	// Receives converted output piece by piece. The view is only valid during the call.
+	using morse_output_callback = std::function<void(std::string_view)>;
+
+	/*
+	* @brief Encodes text pushed in chunks of any size and hands the morse to a callback or stream as it goes.
+	* Memory use does not depend on the input size. Call finish() once the text ends to flush the rest of the output.
+	* The output is the same as morse_converter::encode over the whole text.
+	*/
+	class morse_stream_encoder
+	{
+	public:
+		static constexpr size_t buffer_size = 4096;
+
+		morse_stream_encoder(morse_format fmt, morse_output_callback output) : m_tables(detail::get_tables(fmt)), m_output(std::move(output))
+		{
+			m_buffer.reserve(buffer_size);
+		}
+
+		morse_stream_encoder(morse_format fmt, std::ostream& os) : morse_stream_encoder(fmt, [&os](std::string_view out) { os.write(out.data(), static_cast<std::streamsize>(out.size())); }) {}
+
+		void push(std::string_view chunk)
+		{
+			THUG_STATS_TIMER(conversion_stage::encode);
+			THUG_STATS(size_t written = 0, dropped = 0;)
+			for (char c : chunk)
+			{
+				if (m_started)
+					m_buffer += ' '; // every letter but the first one is preceded by a separator
+				THUG_STATS(written += m_started;)
+				m_started = true;
+
+				const auto& code = m_tables->encode.codes[static_cast<uint8_t>(c)];
+				m_buffer.append(code.keys, code.size);
+				THUG_STATS(written += code.size; dropped += code.size == 0;)
+				if (m_buffer.size() > buffer_size - detail::max_code_length - 1)
+					flush();
+			}
+			THUG_STATS(auto& stats = detail::thread_stats(); stats.bytes_in += chunk.size(); stats.bytes_out += written; stats.letters += chunk.size(); stats.dropped_letters += dropped;)
+		}
+
+		// Ends the current text. Pushing after this starts a new one.
+		void finish()
+		{
+			flush();
+			m_started = false;
+		}
+	private:
+		void flush()
+		{
+			if (!m_buffer.empty())
+				m_output(m_buffer);
+			m_buffer.clear();
+		}
+
+		detail::morse_tables_handle m_tables;
+		morse_output_callback m_output;
+		std::string m_buffer;
+		bool m_started = false;
+	};
+
+	/*
+	* @brief Decodes morse pushed in chunks of any size and hands the text to a callback or stream as it goes.
+	* A token cut by a chunk boundary is carried over to the next chunk. Only its packed code is kept, so memory use stays constant.
+	* Call finish() once the morse ends to decode the last token and flush the rest of the output.
+	* The output is the same as morse_converter::decode over the whole morse.
+	*/
+	class morse_stream_decoder
+	{
+	public:
+		static constexpr size_t buffer_size = 4096;
+
+		morse_stream_decoder(morse_format fmt, morse_output_callback output) : m_tables(detail::get_tables(fmt)), m_output(std::move(output))
+		{
+			m_buffer.reserve(buffer_size);
+		}
+
+		morse_stream_decoder(morse_format fmt, std::ostream& os) : morse_stream_decoder(fmt, [&os](std::string_view out) { os.write(out.data(), static_cast<std::streamsize>(out.size())); }) {}
+
+		void push(std::string_view chunk)
+		{
+			THUG_STATS_TIMER(conversion_stage::decode);
+			THUG_STATS(detail::thread_stats().bytes_in += chunk.size();)
+			for (char c : chunk)
+			{
+				auto key = m_tables->key_classes[c];
+				if (key != detail::key_class::separator)
+					m_token.push(key);
+				else if (!m_token.empty())
+					add_letter();
+			}
+		}
+
+		// Ends the current morse. Pushing after this starts a new one.
+		void finish()
+		{
+			if (!m_token.empty())
+				add_letter();
+			flush();
+		}
+	private:
+		void add_letter()
+		{
+			char letter = m_token.finish();
+			THUG_STATS(auto& stats = detail::thread_stats(); ++stats.tokens; stats.unknown_tokens += letter == '\0'; stats.bytes_out += letter != '\0';)
+			if (letter != '\0')
+			{
+				m_buffer += letter;
+				if (m_buffer.size() == buffer_size)
+					flush();
+			}
+		}
+
+		void flush()
+		{
+			if (!m_buffer.empty())
+				m_output(m_buffer);
+			m_buffer.clear();
+		}
+
+		detail::morse_tables_handle m_tables;
+		detail::token_decoder m_token;
+		morse_output_callback m_output;
+		std::string m_buffer;
+	};
+
+	namespace detail
+	{
+		template <typename Stream>
+		void push_all(std::istream& is, Stream& stream)
+		{
+			char buffer[16384];
+			while (is.read(buffer, sizeof(buffer)) || is.gcount() > 0)
+				stream.push(std::string_view(buffer, static_cast<size_t>(is.gcount())));
+			stream.finish();
+		}
+
+#ifdef THUG_HAS_MMAP
+		class unique_fd
+		{
+		public:
+			explicit unique_fd(int fd) noexcept : m_fd(fd) {}
+			unique_fd(const unique_fd&) = delete;
+			unique_fd& operator=(const unique_fd&) = delete;
+
+			~unique_fd()
+			{
+				if (m_fd >= 0)
+					::close(m_fd);
+			}
+
+			int get() const noexcept
+			{
+				return m_fd;
+			}
+		private:
+			int m_fd;
+		};
+
+		// A mapping of the first size bytes of a file. Evaluates to false if the file could not be mapped.
+		class mapped_file
+		{
+		public:
+			mapped_file() = default;
+
+			mapped_file(int fd, size_t size, int prot, int flags) noexcept
+			{
+				void* data = ::mmap(nullptr, size, prot, flags, fd, 0);
+				if (data != MAP_FAILED)
+				{
+					m_data = static_cast<char*>(data);
+					m_size = size;
+				}
+			}
+
+			mapped_file(mapped_file&& other) noexcept : m_data(other.m_data), m_size(other.m_size)
+			{
+				other.m_data = nullptr;
+				other.m_size = 0;
+			}
+
+			mapped_file& operator=(mapped_file&& other) noexcept
+			{
+				if (this != &other)
+				{
+					reset();
+					std::swap(m_data, other.m_data);
+					std::swap(m_size, other.m_size);
+				}
+				return *this;
+			}
+
+			~mapped_file()
+			{
+				reset();
+			}
+
+			explicit operator bool() const noexcept
+			{
+				return m_data != nullptr;
+			}
+
+			char* data() const noexcept
+			{
+				return m_data;
+			}
+
+			size_t size() const noexcept
+			{
+				return m_size;
+			}
+
+			void reset() noexcept
+			{
+				if (m_data != nullptr)
+					::munmap(m_data, m_size);
+				m_data = nullptr;
+				m_size = 0;
+			}
+		private:
+			char* m_data = nullptr;
+			size_t m_size = 0;
+		};
+
+		// Pipes, terminals and character devices are not regular files and can't be mapped.
+		inline bool regular_file_size(int fd, size_t& size) noexcept
+		{
+			struct stat st;
+			if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+				return false;
+			size = static_cast<size_t>(st.st_size);
+			return true;
+		}
+
+		// True if both descriptors refer to the same regular file, such as an output path that names the input.
+		inline bool same_file(int left, int right) noexcept
+		{
+			struct stat left_st, right_st;
+			return ::fstat(left, &left_st) == 0 && ::fstat(right, &right_st) == 0 && S_ISREG(left_st.st_mode)
+				&& left_st.st_dev == right_st.st_dev && left_st.st_ino == right_st.st_ino;
+		}
+
+		inline bool write_all(int fd, const char* data, size_t size) noexcept
+		{
+			while (size > 0)
+			{
+				auto written = ::write(fd, data, size);
+				if (written < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					return false;
+				}
+				data += written;
+				size -= static_cast<size_t>(written);
+			}
+			return true;
+		}
+#endif // THUG_HAS_MMAP
+
+		/*
+		* @brief Converts the file at in_path into the file at out_path.
+		* If both are regular files, the input is mapped and the converted bytes are written straight into a mapping of the output,
+		* which is sized with output_size first and truncated to what convert actually wrote afterwards.
+		* Anything else (pipes, stdin, empty or unmappable files) goes through Stream with a buffered read loop.
+		*/
+		template <typename Stream, typename SizeFn, typename ConvertFn>
+		bool convert_file_to(const std::string& in_path, const std::string& out_path, morse_format fmt, SizeFn output_size, ConvertFn convert)
+		{
+#ifdef THUG_HAS_MMAP
+			unique_fd in(::open(in_path.c_str(), O_RDONLY | O_CLOEXEC));
+			if (in.get() < 0)
+				return false;
+			// Not truncated on open: if out_path names the input, truncating it would destroy the input before it is read.
+			unique_fd out(::open(out_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+			if (out.get() < 0 || same_file(in.get(), out.get()))
+				return false;
+
+			size_t in_size = 0;
+			size_t out_size = 0;
+			if (regular_file_size(out.get(), out_size) && out_size != 0 && ::ftruncate(out.get(), 0) != 0)
+				return false;
+			mapped_file input;
+			if (regular_file_size(in.get(), in_size) && in_size > 0)
+			{
+				input = mapped_file(in.get(), in_size, PROT_READ, MAP_PRIVATE);
+				if (input)
+					::madvise(input.data(), input.size(), MADV_SEQUENTIAL);
+			}
+
+			if (input && regular_file_size(out.get(), out_size))
+			{
+				std::string_view view(input.data(), input.size());
+				size_t capacity = output_size(view);
+				if (capacity == 0)
+					return true;
+				if (::ftruncate(out.get(), static_cast<off_t>(capacity)) != 0)
+					return false;
+
+				mapped_file output(out.get(), capacity, PROT_READ | PROT_WRITE, MAP_SHARED);
+				if (!output)
+					return false;
+				size_t written = static_cast<size_t>(convert(view, output.data()) - output.data());
+				output.reset();
+				return written == capacity || ::ftruncate(out.get(), static_cast<off_t>(written)) == 0;
+			}
+
+			bool ok = true;
+			Stream stream(fmt, [&](std::string_view piece) { ok = ok && write_all(out.get(), piece.data(), piece.size()); });
+			if (input)
+			{
+				stream.push(std::string_view(input.data(), input.size()));
+			}
+			else
+			{
+				char buffer[65536];
+				for (;;)
+				{
+					auto count = ::read(in.get(), buffer, sizeof(buffer));
+					if (count == 0)
+						break;
+					if (count < 0)
+					{
+						if (errno == EINTR)
+							continue;
+						ok = false;
+						break;
+					}
+					stream.push(std::string_view(buffer, static_cast<size_t>(count)));
+				}
+			}
+			stream.finish();
+			return ok;
+#else // THUG_HAS_MMAP
+			std::ifstream istr(in_path);
+			if (!istr.is_open())
+				return false;
+			std::error_code ec;
+			if (std::filesystem::equivalent(in_path, out_path, ec))
+				return false;
+			std::ofstream ostr(out_path);
+			if (!ostr.is_open())
+				return false;
+			Stream stream(fmt, ostr);
+			push_all(istr, stream);
+			return static_cast<bool>(ostr);
+#endif // THUG_HAS_MMAP
+		}
+	}
+
+	enum class conversion_direction
+	{
+		encode,
+		decode
+	};
+
+	struct file_job_options
+	{
+		conversion_direction direction = conversion_direction::encode;
+		std::string output_directory; // created if missing. Empty means next to each input
+		std::string output_suffix; // appended to the input's file name, e.g. ".morse"
+		unsigned thread_count = 0; // 0 means std::thread::hardware_concurrency()
+	};
+
+	struct file_job_error
+	{
+		std::string path; // the input
+		std::string message;
+	};
+
+	struct file_job_result
+	{
+		size_t files = 0; // converted without errors
+		uint64_t bytes_in = 0;
+		uint64_t bytes_out = 0;
+		double seconds = 0.0; // wall time of the whole job
+		std::vector<file_job_error> errors; // in input order
+
+		// Input bytes per second.
+		double throughput() const noexcept
+		{
+			return seconds > 0.0 ? static_cast<double>(bytes_in) / seconds : 0.0;
+		}
+	};
+
+	namespace detail
+	{
+		/*
+		* @brief Runs fn(index, next) for every index in order on up to thread_count threads, the calling thread included.
+		* The indices are dealt round-robin into one deque per thread. A thread takes from the front of its own deque and, once that is empty,
+		* steals from the back of the others, so threads that drew small items help the ones that drew large items.
+		* next is the index the thread will take after this one, or npos if it doesn't know yet, so fn can prepare it.
+		*/
+		template <typename Fn>
+		void work_stealing_for(const std::vector<size_t>& order, unsigned thread_count, Fn&& fn)
+		{
+			struct work_queue
+			{
+				std::mutex mutex;
+				std::deque<size_t> items;
+			};
+
+			size_t workers = std::max<size_t>(1, std::min<size_t>(order.size(), thread_count));
+			std::unique_ptr<work_queue[]> queues(new work_queue[workers]);
+			for (size_t i = 0; i < order.size(); ++i)
+				queues[i % workers].items.push_back(order[i]);
+
+			auto take = [&](size_t self, size_t& index, size_t& next)
+				{
+					{
+						std::lock_guard<std::mutex> lock(queues[self].mutex);
+						auto& own = queues[self].items;
+						if (!own.empty())
+						{
+							index = own.front();
+							own.pop_front();
+							next = own.empty() ? std::string::npos : own.front();
+							return true;
+						}
+					}
+					for (size_t k = 1; k < workers; ++k)
+					{
+						auto& victim = queues[(self + k) % workers];
+						std::lock_guard<std::mutex> lock(victim.mutex);
+						if (!victim.items.empty())
+						{
+							index = victim.items.back();
+							victim.items.pop_back();
+							next = std::string::npos;
+							return true;
+						}
+					}
+					return false;
+				};
+			auto worker = [&](size_t self)
+				{
+					size_t index = 0, next = 0;
+					while (take(self, index, next))
+						fn(index, next);
+				};
+
+			THUG_STATS(conversion_stats gathered; std::mutex gathered_mutex;)
+			std::vector<std::thread> threads;
+			threads.reserve(workers - 1);
+			for (size_t i = 1; i < workers; ++i)
+			{
+				threads.emplace_back([&, i]()
+					{
+						worker(i);
+						THUG_STATS(std::lock_guard<std::mutex> lock(gathered_mutex); gathered += thread_stats();)
+					});
+			}
+			worker(0);
+			for (auto& thread : threads)
+				thread.join();
+			THUG_STATS(thread_stats() += gathered;)
+		}
+
+		// Asks the OS to start reading a file into the page cache, so it is there by the time it is converted.
+		inline void prefetch_file(const std::string& path) noexcept
+		{
+#if defined(THUG_HAS_MMAP) && defined(POSIX_FADV_WILLNEED)
+			unique_fd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+			if (fd.get() >= 0)
+				::posix_fadvise(fd.get(), 0, 0, POSIX_FADV_WILLNEED);
+#else
+			(void)path;
+#endif
+		}
+
+		// Checks the inputs, then converts them largest first with work_stealing_for. convert(in_path, out_path) returns false on failure.
+		template <typename ConvertFn>
+		file_job_result run_file_job(const std::vector<std::string>& inputs, const file_job_options& options, ConvertFn convert)
+		{
+			namespace fs = std::filesystem;
+			auto start = std::chrono::steady_clock::now();
+			std::vector<std::string> errors(inputs.size());
+			std::error_code ec;
+
+			if (!options.output_directory.empty() && !fs::is_directory(options.output_directory, ec) && !fs::create_directories(options.output_directory, ec))
+			{
+				for (auto& error : errors)
+					error = "can't create the output directory " + options.output_directory;
+			}
+
+			struct file_task
+			{
+				std::string output;
+				uint64_t size = 0;
+				uint64_t output_size = 0;
+			};
+			std::vector<file_task> tasks(inputs.size());
+			std::unordered_set<std::string> outputs;
+			std::vector<size_t> order;
+			for (size_t i = 0; i < inputs.size(); ++i)
+			{
+				if (!errors[i].empty())
+					continue;
+				fs::path input(inputs[i]);
+				if (!fs::is_regular_file(input, ec))
+				{
+					errors[i] = fs::exists(input, ec) ? "not a regular file" : "no such file";
+					continue;
+				}
+
+				fs::path output = options.output_directory.empty() ? input.parent_path() : fs::path(options.output_directory);
+				output /= input.filename();
+				output += options.output_suffix;
+				if (fs::equivalent(input, output, ec))
+				{
+					errors[i] = "the output would overwrite the input";
+					continue;
+				}
+				tasks[i].output = output.string();
+				if (!outputs.insert(fs::weakly_canonical(output, ec).string()).second)
+				{
+					errors[i] = "another input has the same output file";
+					continue;
+				}
+				tasks[i].size = fs::file_size(input, ec);
+				order.push_back(i);
+			}
+
+			// Largest files first: the last items left to steal are then the small ones, so no thread finishes long after the others.
+			std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right) { return tasks[left].size > tasks[right].size; });
+			unsigned threads = options.thread_count != 0 ? options.thread_count : std::max(1u, std::thread::hardware_concurrency());
+			work_stealing_for(order, threads, [&](size_t i, size_t next)
+				{
+					if (next != std::string::npos)
+						prefetch_file(inputs[next]);
+					std::error_code size_ec;
+					if (!convert(inputs[i], tasks[i].output))
+						errors[i] = "can't read the input or write " + tasks[i].output;
+					else
+						tasks[i].output_size = fs::file_size(tasks[i].output, size_ec);
+				});
+
+			file_job_result result;
+			for (size_t i = 0; i < inputs.size(); ++i)
+			{
+				if (!errors[i].empty())
+				{
+					result.errors.push_back({ inputs[i], std::move(errors[i]) });
+					continue;
+				}
+				++result.files;
+				result.bytes_in += tasks[i].size;
+				result.bytes_out += tasks[i].output_size;
+			}
+			result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			return result;
+		}
+	}
+
+	namespace detail
+	{
+		// Edit distances above this are clamped. Tokens longer than max_code_length + the bound can't reach any code and are rejected right away.
+		constexpr size_t max_repair_distance = 8;
+
+		/*
+		* @brief Finds the valid code closest to a token by edit distance (insertions, deletions and substitutions, all costing 1).
+		* Packed codes form an implicit binary trie: the children of p are 2p (short press) and 2p + 1 (long press).
+		* One row of the edit distance table is carried down each branch, and the branch is cut once its smallest entry exceeds the best distance so far,
+		* or equals it and no code further down is closer in length to the token.
+		* Ties prefer codes as long as the token, which favors substituting a bad key over dropping it.
+		*/
+		class nearest_code_search
+		{
+		public:
+			nearest_code_search(std::string_view token, morse_format fmt, size_t max_distance) noexcept
+				: m_token(token), m_fmt(fmt), m_best_distance(std::min(max_distance, max_repair_distance) + 1) {}
+
+			// Writes the closest code in the token's format to result. Returns false if no code is within the distance bound.
+			template <typename String>
+			bool find(String& result)
+			{
+				if (m_token.size() > max_code_length + m_best_distance - 1)
+					return false;
+
+				// The space letter is a single space key. It is only offered when the token has one: otherwise a lone foreign byte would tie
+				// with e and t at distance 1 and put a word break into the text.
+				if (m_token.find(m_fmt.space) != std::string_view::npos)
+					consider(1, m_token.size() - 1, 1);
+
+				// Row 0 is the distance from the empty code: j deletions. The whole row is written, so the compiler can see it fits.
+				for (size_t j = 0; j < row_size; ++j)
+					m_rows[0][j] = static_cast<uint8_t>(j);
+				visit(2, 1);
+				visit(3, 1);
+
+				if (m_best_packed == 0)
+					return false;
+				result.clear();
+				if (m_best_packed == 1)
+				{
+					result += m_fmt.space;
+					return true;
+				}
+				size_t length = 0;
+				while ((m_best_packed >> (length + 1)) != 0)
+					++length;
+				for (size_t k = length; k-- > 0;)
+					result += ((m_best_packed >> k) & 1u) ? m_fmt.long_press : m_fmt.short_press;
+				return true;
+			}
+		private:
+			void visit(unsigned packed, size_t depth) noexcept
+			{
+				const char key = (packed & 1u) ? m_fmt.long_press : m_fmt.short_press;
+				const uint8_t* above = m_rows[depth - 1];
+				uint8_t* row = m_rows[depth];
+
+				row[0] = static_cast<uint8_t>(depth);
+				uint8_t smallest = row[0];
+				for (size_t j = 1; j <= m_token.size(); ++j)
+				{
+					uint8_t substitute = static_cast<uint8_t>(above[j - 1] + (m_token[j - 1] == key ? 0 : 1));
+					row[j] = std::min({ static_cast<uint8_t>(above[j] + 1), static_cast<uint8_t>(row[j - 1] + 1), substitute });
+					smallest = std::min(smallest, row[j]);
+				}
+
+				if (morse_decode_index.letters[packed] != '\0')
+					consider(packed, row[m_token.size()], depth);
+				if (depth == max_code_length || smallest > m_best_distance || (smallest == m_best_distance && !can_improve_length_gap(depth)))
+					return;
+				visit(packed << 1, depth + 1);
+				visit((packed << 1) | 1u, depth + 1);
+			}
+
+			// Whether a code below depth could tie with the best distance and still win on the length gap. Nothing ties with the bound itself.
+			bool can_improve_length_gap(size_t depth) const noexcept
+			{
+				if (m_best_packed == 0)
+					return false;
+				size_t length = std::min(std::max(m_token.size(), depth + 1), max_code_length);
+				size_t length_gap = length > m_token.size() ? length - m_token.size() : m_token.size() - length;
+				return length_gap < m_best_length_gap;
+			}
+
+			void consider(unsigned packed, size_t distance, size_t length) noexcept
+			{
+				size_t length_gap = length > m_token.size() ? length - m_token.size() : m_token.size() - length;
+				if (distance < m_best_distance || (distance == m_best_distance && m_best_packed != 0 && length_gap < m_best_length_gap))
+				{
+					m_best_distance = distance;
+					m_best_length_gap = length_gap;
+					m_best_packed = packed;
+				}
+			}
+
+			static constexpr size_t row_size = max_code_length + max_repair_distance + 1; // a token can't be longer than this and reach a code
+
+			std::string_view m_token;
+			morse_format m_fmt;
+			size_t m_best_distance;
+			size_t m_best_length_gap = 0;
+			unsigned m_best_packed = 0;
+			uint8_t m_rows[max_code_length + 1][row_size] = {};
+		};
+	}
+
+	enum class repair_mode
+	{
+		remove_incorrect_letter = 0, // Completely removes the incorrect letter
+		remove_incorrect_key = 1, // It first tries to remove the wrong key. If the result doesn't make sense, it removes that letter entirely.
+		try_replacing_with_short_press = 2, // It tries to replace the faulty key with short press key. If the result doesn't make sense, it removes that letter entirely.
+		try_replacing_with_long_press = 3, // It tries to replace the faulty key with long press key. If the result doesn't make sense, it removes that letter entirely.
+		try_ordered_repair_list_one_by_one = 4, // It tries the repairs on the ordered list one by one. If none of them work, it removes the letter entirely.
+		try_nearest_valid_code = 5, // It replaces the letter with the valid code at the smallest edit distance, so wrong dits and dahs are fixed too. If no code is close enough, it removes that letter entirely.
+		default_mode = remove_incorrect_letter // Default mode is remove_incorrect_letter
+	};
+
+	// What repair_and_decode did with a token that was not a valid code.
+	struct token_diagnostic
+	{
+		size_t offset; // of the token in the morse
+		std::string_view token; // the token as it was, a view into the morse
+		char letter; // what it was decoded to, '\0' if it was removed
+		bool repaired;
+		repair_mode repair; // the mode that repaired it, the requested one if it was removed
+	};
+
+	/*
+	* @brief The modes try_ordered_repair_list_one_by_one tries in turn, and how far try_nearest_valid_code may look.
+	* It is checked once when it is made: repeated modes and the ones that can't repair a letter by themselves
+	* (remove_incorrect_letter, try_ordered_repair_list_one_by_one) are dropped, and max_distance is clamped to 8.
+	* It can't be changed afterwards, so one policy can be shared by any number of threads.
+	*/
+	class repair_policy
+	{
+	public:
+		// remove_incorrect_key, try_replacing_with_short_press, try_replacing_with_long_press
+		constexpr repair_policy() noexcept : repair_policy(size_t{ 2 }) {}
+
+		explicit constexpr repair_policy(size_t max_distance) noexcept
+			: repair_policy({ repair_mode::remove_incorrect_key, repair_mode::try_replacing_with_short_press, repair_mode::try_replacing_with_long_press }, max_distance) {}
+
+		constexpr repair_policy(std::initializer_list<repair_mode> order, size_t max_distance = 2) noexcept
+			: m_max_distance(std::min(max_distance, detail::max_repair_distance))
+		{
+			for (repair_mode mode : order)
+				add(mode);
+		}
+
+		repair_policy(const std::vector<repair_mode>& order, size_t max_distance = 2) noexcept
+			: m_max_distance(std::min(max_distance, detail::max_repair_distance))
+		{
+			for (repair_mode mode : order)
+				add(mode);
+		}
+
+		// The same order with another max_distance.
+		constexpr repair_policy with_max_distance(size_t max_distance) const noexcept
+		{
+			repair_policy result = *this;
+			result.m_max_distance = std::min(max_distance, detail::max_repair_distance);
+			return result;
+		}
+
+		constexpr const repair_mode* begin() const noexcept { return m_order; }
+		constexpr const repair_mode* end() const noexcept { return m_order + m_size; }
+		constexpr size_t size() const noexcept { return m_size; }
+		constexpr bool empty() const noexcept { return m_size == 0; }
+		constexpr size_t max_distance() const noexcept { return m_max_distance; }
+
+	private:
+		constexpr void add(repair_mode mode) noexcept
+		{
+			if (mode == repair_mode::remove_incorrect_letter || mode == repair_mode::try_ordered_repair_list_one_by_one)
+				return;
+			for (size_t i = 0; i < m_size; ++i)
+				if (m_order[i] == mode)
+					return;
+			m_order[m_size++] = mode;
+		}
+
+		repair_mode m_order[4]{}; // at most the four modes that repair by themselves
+		size_t m_size = 0;
+		size_t m_max_distance = 2;
+	};
+
+	namespace detail
+	{
+		// What set_repair_order sets. Copied out under the lock, so a repair never sees a half written order.
+		struct shared_repair_policy
+		{
+			std::mutex mutex;
+			repair_policy policy;
+
+			repair_policy load()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				return policy;
+			}
+
+			void store(const repair_policy& new_policy)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				policy = new_policy;
+			}
+		};
+
+		inline shared_repair_policy& global_repair_policy()
+		{
+			static shared_repair_policy instance;
+			return instance;
+		}
+	}
+
+	/*
+	* @brief Letter frequencies that decode_segmented scores splits with, keyed by packed code so one model serves any format.
+	* The default model holds English letter frequencies only. train learns letter and letter pair frequencies from sample text,
+	* which lets a split be judged by how its letters follow each other. Word gaps count as a letter, so word starts and ends are learned too.
+	*/
+	class letter_model
+	{
+	public:
+		letter_model() : m_unigrams(256, std::log(0.001f))
+		{
+			// Percent of letters in English text. Digits are common in radio traffic and get more than the rarest letters.
+			constexpr float english[26] = { 8.2f, 1.5f, 2.8f, 4.3f, 12.7f, 2.2f, 2.0f, 6.1f, 7.0f, 0.15f, 0.77f, 4.0f, 2.4f,
+				6.7f, 7.5f, 1.9f, 0.095f, 6.0f, 6.3f, 9.1f, 2.8f, 0.98f, 2.4f, 0.15f, 2.0f, 0.074f };
+			for (char c = 'a'; c <= 'z'; ++c)
+				m_unigrams[latin_alphabet.ascii[static_cast<uint8_t>(c)]] = std::log(english[c - 'a'] / 100.0f);
+			for (char c = '0'; c <= '9'; ++c)
+				m_unigrams[latin_alphabet.ascii[static_cast<uint8_t>(c)]] = std::log(0.005f);
+		}
+
+		// Learns from text with add-one smoothing over the letters of alphabet, so letters and pairs missing from text still score.
+		static letter_model train(std::string_view text, const morse_alphabet& alphabet = latin_alphabet)
+		{
+			std::vector<uint32_t> unigrams(256, 0), bigrams(256 * 256, 0);
+			uint8_t previous = 1; // text starts after a word gap
+			detail::for_each_letter_code(text, alphabet, [&](uint8_t code)
+				{
+					if (code == 0 || (code == 1 && previous == 1))
+						return;
+					++unigrams[code];
+					++bigrams[previous * 256u + code];
+					previous = code;
+				});
+
+			float letters = 0.0f;
+			for (unsigned code = 1; code < 256; ++code)
+				letters += alphabet.letters[code] != 0 ? 1.0f : 0.0f;
+			float total = 0.0f;
+			for (uint32_t count : unigrams)
+				total += static_cast<float>(count);
+
+			letter_model result;
+			result.m_bigrams.resize(256 * 256);
+			for (unsigned code = 0; code < 256; ++code)
+				result.m_unigrams[code] = std::log((static_cast<float>(unigrams[code]) + 1.0f) / (total + letters));
+			for (unsigned previous_code = 0; previous_code < 256; ++previous_code)
+			{
+				float context = static_cast<float>(unigrams[previous_code]) + (previous_code == 1 ? 1.0f : 0.0f);
+				for (unsigned code = 0; code < 256; ++code)
+					result.m_bigrams[previous_code * 256 + code] = std::log((static_cast<float>(bigrams[previous_code * 256 + code]) + 1.0f) / (context + letters));
+			}
+			return result;
+		}
+
+		// Log probability of the letter with packed code, after the letter with packed code previous.
+		float score(uint8_t previous, uint8_t code) const noexcept
+		{
+			return m_bigrams.empty() ? m_unigrams[code] : m_bigrams[previous * 256u + code];
+		}
+	private:
+		std::vector<float> m_unigrams;
+		std::vector<float> m_bigrams; // empty, or log P(code | previous) at previous * 256 + code
+	};
+
+	struct segmentation_options
+	{
+		size_t beam_width = 8; // splits kept at each key position, a bound on the work per key. 1 keeps only the best one
+		const letter_model* model = nullptr; // nullptr for the default model with English letter frequencies
+	};
+
+	namespace detail
+	{
+		/*
+		* @brief Finds the most likely split of a token that lost its letter separators into valid codes.
+		* The packed codes form a binary trie: a code extended by a key is code * 2 + key, so the codes starting at a key position
+		* are found by walking it until no valid code has that prefix. A beam of at most beam_width splits, one per last letter,
+		* is kept for each position, which bounds the work per key by the longest code times the beam width.
+		*/
+		class token_segmenter
+		{
+		public:
+			token_segmenter(const morse_alphabet& alphabet, const letter_model& model, size_t beam_width)
+				: m_model(model), m_beam_width(std::max<size_t>(beam_width, 1))
+			{
+				for (unsigned code = 255; code > 1; --code)
+				{
+					m_valid[code] = alphabet.letters[code] != 0;
+					m_prefix[code >> 1] = m_prefix[code >> 1] || m_valid[code] || m_prefix[code];
+				}
+			}
+
+			/*
+			* @brief Appends the packed codes of the best split of token to codes. A token that already is a valid code is kept whole, as decode would.
+			* previous is the letter before the token and becomes the last one of the split. following is the letter after it, 0 if
+			* that is not known yet. Returns false if token has bytes that are not keys or can't be split into valid codes at all.
+			*/
+			bool segment(std::string_view token, const key_class_table& classes, uint8_t& previous, uint8_t following, std::vector<uint8_t>& codes)
+			{
+				unsigned whole = 1;
+				for (char c : token)
+				{
+					key_class key = classes[c];
+					if (key != key_class::short_press && key != key_class::long_press && key != key_class::space)
+						return false;
+					whole = whole == 0 || whole >= 128 || key == key_class::space ? 0 : whole * 2 + (key == key_class::long_press);
+				}
+				if (token.size() == 1 && classes[token[0]] == key_class::space)
+					whole = 1;
+				if (whole != 0 && (whole == 1 || m_valid[whole]))
+				{
+					codes.push_back(static_cast<uint8_t>(whole));
+					previous = static_cast<uint8_t>(whole);
+					return true;
+				}
+
+				m_nodes.assign(1, { 0.0f, previous, no_parent });
+				size_t begin = 0, end = 1;
+				for (size_t position = 0;; ++position)
+				{
+					if (position > 0)
+					{
+						begin = m_nodes.size();
+						keep_best(m_pending[position % ring_size]);
+						end = m_nodes.size();
+					}
+					if (position == token.size())
+						break;
+					for (size_t i = begin; i < end; ++i)
+						expand(token, classes, position, static_cast<uint32_t>(i));
+				}
+
+				if (begin == end)
+					return false;
+				uint32_t best = static_cast<uint32_t>(begin);
+				float best_score = -INFINITY;
+				for (size_t i = begin; i < end; ++i)
+				{
+					float score = m_nodes[i].score + (following != 0 ? m_model.score(m_nodes[i].code, following) : 0.0f);
+					if (score > best_score)
+					{
+						best = static_cast<uint32_t>(i);
+						best_score = score;
+					}
+				}
+				previous = m_nodes[best].code;
+				size_t first = codes.size();
+				for (uint32_t i = best; m_nodes[i].parent != no_parent; i = m_nodes[i].parent)
+					codes.push_back(m_nodes[i].code);
+				std::reverse(codes.begin() + static_cast<std::ptrdiff_t>(first), codes.end());
+				return true;
+			}
+		private:
+			struct segment_node
+			{
+				float score;
+				uint8_t code; // the last letter
+				uint32_t parent; // the node the letter was added to
+			};
+
+			static constexpr uint32_t no_parent = UINT32_MAX;
+			static constexpr size_t ring_size = max_code_length + 1;
+
+			// Adds every letter that starts at position to the split ending in node, as a candidate for the position the letter ends at.
+			void expand(std::string_view token, const key_class_table& classes, size_t position, uint32_t node)
+			{
+				const segment_node& from = m_nodes[node];
+				auto add = [&](unsigned code, size_t next)
+					{
+						m_pending[next % ring_size].push_back({ from.score + m_model.score(from.code, static_cast<uint8_t>(code)), static_cast<uint8_t>(code), node });
+					};
+
+				if (classes[token[position]] == key_class::space)
+				{
+					add(1, position + 1);
+					return;
+				}
+				unsigned code = 1;
+				for (size_t k = position; k < token.size() && k - position < max_code_length; ++k)
+				{
+					key_class key = classes[token[k]];
+					if (key == key_class::space)
+						break;
+					code = code * 2 + (key == key_class::long_press);
+					if (m_valid[code])
+						add(code, k + 1);
+					if (!m_prefix[code])
+						break;
+				}
+			}
+
+			// Moves the best candidate for each last letter, at most beam_width of them, from candidates to the nodes.
+			void keep_best(std::vector<segment_node>& candidates)
+			{
+				std::sort(candidates.begin(), candidates.end(), [](const segment_node& left, const segment_node& right) { return left.score > right.score; });
+				bool taken[256] = {};
+				size_t kept = 0;
+				for (const auto& candidate : candidates)
+				{
+					if (taken[candidate.code])
+						continue;
+					taken[candidate.code] = true;
+					m_nodes.push_back(candidate);
+					if (++kept == m_beam_width)
+						break;
+				}
+				candidates.clear();
+			}
+
+			const letter_model& m_model;
+			size_t m_beam_width;
+			bool m_valid[256] = {};
+			bool m_prefix[256] = {}; // some valid code is longer and starts with this one
+			std::vector<segment_node> m_nodes;
+			std::vector<segment_node> m_pending[ring_size]; // candidates by the position they end at
+		};
+
+		inline const letter_model& default_letter_model()
+		{
+			static const letter_model model;
+			return model;
+		}
+	}
+
+	// The outputs of a batch conversion, stored back to back in one buffer like a string column. Message i is data[offsets[i], offsets[i + 1]).
+	struct morse_batch
+	{
+		std::string data;
+		std::vector<size_t> offsets{ 0 };
+
+		size_t size() const noexcept
+		{
+			return offsets.size() - 1;
+		}
+
+		std::string_view operator[](size_t i) const noexcept
+		{
+			return std::string_view(data).substr(offsets[i], offsets[i + 1] - offsets[i]);
+		}
+	};
+
+	class morse_converter
+	{
+	public:
+		morse_converter(char long_press_key = default_format.long_press, char short_press_key = default_format.short_press, char space_key = default_format.space) : m_format({ long_press_key, short_press_key, space_key })
+		{
+			load_tables();
+		}
+
+		morse_converter(morse_format fmt) : m_format(fmt)
+		{
+			load_tables();
+		}
+
+		// Copies share the tables, so copying costs a reference count increment. A moved-from converter stays usable.
+		morse_converter(const morse_converter& other) = default;
+
+		morse_converter& operator=(morse_format fmt)
+		{
+			set_format(fmt);
+			return *this;
+		}
+
+		morse_converter& operator=(const morse_converter& other) = default;
+
+		void set_format(char long_press_key, char short_press_key, char space_key = default_format.space)
+		{
+			m_format = { long_press_key, short_press_key, space_key };
+			load_tables();
+		}
+
+		void set_format(morse_format fmt)
+		{
+			m_format = fmt;
+			load_tables();
+		}
+
+		// text to morse
+		std::string encode(std::string_view text) const
+		{
+			std::string result;
+			encode_into(text, result);
+			return result;
+		}
+
+		// morse to text
+		std::string decode(std::string_view morse) const
+		{
+			std::string result;
+			decode_into(morse, result);
+			return result;
+		}
+
+		// Exact size of encode(text).
+		size_t encoded_size(std::string_view text) const noexcept
+		{
+			return detail::encoded_size(text, m_tables->encode);
+		}
+
+		// decode(morse) is never longer than this. Costs nothing to compute.
+		static constexpr size_t decoded_size_upper_bound(std::string_view morse) noexcept
+		{
+			return detail::decoded_size_upper_bound(morse);
+		}
+
+		// Replaces the contents of out with encode(text). Reuses the capacity of out, so it doesn't allocate once out is large enough.
+		template <typename Allocator>
+		void encode_into(std::string_view text, std::basic_string<char, std::char_traits<char>, Allocator>& out) const
+		{
+			out.resize(encoded_size(text));
+			detail::encode_to(text, m_tables->encode, out.data());
+		}
+
+		// Replaces the contents of out with decode(morse). Reuses the capacity of out, so it doesn't allocate once out is large enough.
+		template <typename Allocator>
+		void decode_into(std::string_view morse, std::basic_string<char, std::char_traits<char>, Allocator>& out) const
+		{
+			out.resize(decoded_size_upper_bound(morse));
+			out.resize(static_cast<size_t>(detail::decode_to(morse, m_tables->key_classes, out.data()) - out.data()));
+		}
+
+#ifdef THUG_HAS_PMR
+		// Same as encode, with the result allocated from resource.
+		std::pmr::string encode(std::string_view text, std::pmr::memory_resource* resource) const
+		{
+			std::pmr::string result(resource);
+			encode_into(text, result);
+			return result;
+		}
+
+		// Same as decode, with the result allocated from resource.
+		std::pmr::string decode(std::string_view morse, std::pmr::memory_resource* resource) const
+		{
+			std::pmr::string result(resource);
+			decode_into(morse, result);
+			return result;
+		}
+#endif // THUG_HAS_PMR
+
+#ifdef THUG_HAS_SPAN
+		// Writes encode(text) to the front of out and returns its size. Writes nothing if out is smaller than encoded_size(text).
+		size_t encode_into(std::string_view text, std::span<char> out) const noexcept
+		{
+			size_t size = encoded_size(text);
+			if (size <= out.size())
+				detail::encode_to(text, m_tables->encode, out.data());
+			return size;
+		}
+
+		// Writes decode(morse) to the front of out and returns its size. If out is smaller than decoded_size_upper_bound(morse), nothing is written
+		// and that bound is returned instead, so as with encode_into a result larger than out.size() means the buffer was too small.
+		size_t decode_into(std::string_view morse, std::span<char> out) const noexcept
+		{
+			size_t bound = decoded_size_upper_bound(morse);
+			if (out.size() < bound)
+				return bound;
+			return static_cast<size_t>(detail::decode_to(morse, m_tables->key_classes, out.data()) - out.data());
+		}
+#endif // THUG_HAS_SPAN
+
+		// Writes encode(text) through an output iterator and returns the iterator past the last written byte.
+		template <typename OutputIt>
+		OutputIt encode_into(std::string_view text, OutputIt out) const
+		{
+			return detail::encode_to(text, m_tables->encode, out);
+		}
+
+		// Writes decode(morse) through an output iterator and returns the iterator past the last written byte.
+		template <typename OutputIt>
+		OutputIt decode_into(std::string_view morse, OutputIt out) const
+		{
+			return detail::decode_to(morse, m_tables->key_classes, out);
+		}
+
+		// UTF-8 text to morse with the letters of alphabet. Code points it lacks yield empty codes, as unknown bytes do in encode(text).
+		std::string encode(std::string_view text, const morse_alphabet& alphabet) const
+		{
+			std::string result;
+			encode_into(text, result, alphabet);
+			return result;
+		}
+
+		// morse to UTF-8 text with the letters of alphabet.
+		std::string decode(std::string_view morse, const morse_alphabet& alphabet) const
+		{
+			std::string result;
+			decode_into(morse, result, alphabet);
+			return result;
+		}
+
+		// Exact size of encode(text, alphabet).
+		size_t encoded_size(std::string_view text, const morse_alphabet& alphabet) const noexcept
+		{
+			return detail::encoded_size(text, alphabet, m_tables->packed_codes);
+		}
+
+		// Replaces the contents of out with encode(text, alphabet), reusing its capacity.
+		template <typename Allocator>
+		void encode_into(std::string_view text, std::basic_string<char, std::char_traits<char>, Allocator>& out, const morse_alphabet& alphabet) const
+		{
+			out.resize(encoded_size(text, alphabet));
+			detail::encode_to(text, alphabet, m_tables->packed_codes, out.data());
+		}
+
+		// Replaces the contents of out with decode(morse, alphabet), reusing its capacity.
+		template <typename Allocator>
+		void decode_into(std::string_view morse, std::basic_string<char, std::char_traits<char>, Allocator>& out, const morse_alphabet& alphabet) const
+		{
+			out.resize(decoded_size_upper_bound(morse) * alphabet.max_utf8_size);
+			out.resize(static_cast<size_t>(detail::decode_to(morse, m_tables->key_classes, alphabet, out.data()) - out.data()));
+		}
+
+		/*
+		* @brief Like decode, but a token that is not a valid code, such as a run of letters whose separators were lost, is split into
+		* the most likely sequence of valid codes instead of being dropped (see detail::token_segmenter). Valid tokens decode as they do
+		* in decode. The work is linear in the length of the morse for a given beam width.
+		*/
+		std::string decode_segmented(std::string_view morse, const segmentation_options& options = {}) const
+		{
+			return decode_segmented(morse, latin_alphabet, options);
+		}
+
+		std::string decode_segmented(std::string_view morse, const morse_alphabet& alphabet, const segmentation_options& options = {}) const
+		{
+			THUG_STATS_TIMER(conversion_stage::decode);
+			detail::token_segmenter segmenter(alphabet, options.model != nullptr ? *options.model : detail::default_letter_model(), options.beam_width);
+			std::string result;
+			std::vector<uint8_t> codes;
+			uint8_t previous = 1; // the text starts after a word gap
+			detail::token_range tokens(morse);
+			for (auto it = tokens.begin(), end = tokens.end(); it != end;)
+			{
+				std::string_view token = *it;
+				// A word gap after the token, or the end of the text, is a letter the split has to lead into.
+				uint8_t following = ++it == end || (it->size() == 1 && m_tables->key_classes[(*it)[0]] == detail::key_class::space) ? 1 : 0;
+				THUG_STATS(++detail::thread_stats().tokens;)
+				codes.clear();
+				if (!segmenter.segment(token, m_tables->key_classes, previous, following, codes))
+				{
+					THUG_STATS(++detail::thread_stats().unknown_tokens;)
+					continue;
+				}
+				for (uint8_t code : codes)
+					detail::append_utf8(alphabet.letters[code], std::back_inserter(result));
+			}
+			THUG_STATS(auto& stats = detail::thread_stats(); stats.bytes_in += morse.size(); stats.bytes_out += result.size();)
+			return result;
+		}
+
+		// Binary morse (described at detail::binary_magic) of encode(text, alphabet). It is a quarter of the text size and the same in every format.
+		static std::string encode_binary(std::string_view text, const morse_alphabet& alphabet = latin_alphabet)
+		{
+			THUG_STATS_TIMER(conversion_stage::encode);
+			uint64_t symbols = detail::binary_symbol_count(text, alphabet);
+			size_t size = detail::binary_header_size + detail::binary_payload_size(symbols);
+			std::string result(size + 8, '\0');
+			detail::write_binary_header(result.data(), symbols);
+
+			// Every letter is written with its separator. The one after the last letter is cut off below.
+			detail::binary_writer writer(result.data() + detail::binary_header_size);
+			detail::for_each_letter_code(text, alphabet, [&](uint8_t code)
+				{
+					const auto& code_symbols = detail::binary_codes.codes[code];
+					writer.put(code_symbols.symbols, code_symbols.count);
+					THUG_STATS(auto& stats = detail::thread_stats(); ++stats.letters; stats.dropped_letters += code == 0;)
+				});
+			writer.flush();
+			result.resize(size);
+			THUG_STATS(auto& stats = detail::thread_stats(); stats.bytes_in += text.size(); stats.bytes_out += size;)
+			if (symbols % 4 != 0)
+				result.back() = static_cast<char>(result.back() & ((1 << (2 * (symbols % 4))) - 1));
+			return result;
+		}
+
+		// Decodes binary morse into text. Returns false, leaving text empty, if binary has no valid header or is cut short.
+		static bool decode_binary(std::string_view binary, std::string& text, const morse_alphabet& alphabet = latin_alphabet)
+		{
+			text.clear();
+			uint64_t symbols = 0;
+			if (!detail::read_binary_header(binary, symbols))
+				return false;
+
+			THUG_STATS_TIMER(conversion_stage::decode);
+			constexpr detail::key_class classes[] = { detail::key_class::short_press, detail::key_class::long_press, detail::key_class::space, detail::key_class::separator };
+			const char* payload = binary.data() + detail::binary_header_size;
+			text.resize(static_cast<size_t>((symbols + 1) / 2) * alphabet.max_utf8_size);
+			char* out = text.data();
+			detail::token_decoder token;
+			auto add_letter = [&]()
+				{
+					char32_t letter = alphabet.letters[token.finish_code()];
+					if (letter != 0)
+						out = detail::append_utf8(letter, out);
+					THUG_STATS(auto& stats = detail::thread_stats(); ++stats.tokens; stats.unknown_tokens += letter == 0;)
+				};
+
+			for (uint64_t i = 0; i < symbols; i += 32)
+			{
+				unsigned count = static_cast<unsigned>(std::min<uint64_t>(32, symbols - i));
+				uint64_t word = detail::load_le64(payload + i / 4, detail::binary_payload_size(count));
+				for (unsigned k = 0; k < count; ++k, word >>= 2)
+				{
+					auto key = classes[word & 3u];
+					if (key != detail::key_class::separator)
+						token.push(key);
+					else if (!token.empty())
+						add_letter();
+				}
+			}
+			if (!token.empty())
+				add_letter();
+			text.resize(static_cast<size_t>(out - text.data()));
+			THUG_STATS(auto& stats = detail::thread_stats(); stats.bytes_in += binary.size(); stats.bytes_out += text.size();)
+			return true;
+		}
+
+		// Packs morse in this converter's format into binary morse. Returns false, leaving binary empty, if morse has bytes that are neither keys nor whitespace.
+		bool morse_to_binary(std::string_view morse, std::string& binary) const
+		{
+			size_t size = detail::binary_header_size + detail::binary_payload_size(morse.size());
+			binary.resize(size + 8);
+			detail::write_binary_header(binary.data(), morse.size());
+
+			const auto& classes = m_tables->key_classes;
+			char* out = binary.data() + detail::binary_header_size;
+			for (size_t i = 0; i < morse.size(); i += 32, out += 8)
+			{
+				size_t count = std::min<size_t>(32, morse.size() - i);
+				uint64_t word = 0;
+				uint8_t seen = 0; // binary_invalid has the high bit set
+				for (size_t k = 0; k < count; ++k)
+				{
+					uint8_t symbol = detail::binary_symbol_of[static_cast<uint8_t>(classes[morse[i + k]])];
+					seen |= symbol;
+					word |= static_cast<uint64_t>(symbol & 3u) << (2 * k);
+				}
+				if (seen & 0x80)
+				{
+					binary.clear();
+					return false;
+				}
+				detail::store_le64(out, word);
+			}
+			binary.resize(size);
+			return true;
+		}
+
+		// Unpacks binary morse into this converter's format, with a space for every separator. Returns false, leaving morse empty, if binary has no valid header or is cut short.
+		bool binary_to_morse(std::string_view binary, std::string& morse) const
+		{
+			morse.clear();
+			uint64_t symbols = 0;
+			if (!detail::read_binary_header(binary, symbols))
+				return false;
+
+			size_t bytes = detail::binary_payload_size(symbols);
+			const auto& table = m_tables->binary_keys;
+			morse.resize(bytes * 4);
+			for (size_t i = 0; i < bytes; ++i)
+				std::memcpy(&morse[i * 4], table.keys[static_cast<uint8_t>(binary[detail::binary_header_size + i])], 4);
+			morse.resize(static_cast<size_t>(symbols));
+			return true;
+		}
+
+		/*
+		* @brief Same output as encode, computed on several threads.
+		* The text is cut into equal chunks. Their encoded sizes are counted in parallel, then each chunk is encoded in parallel into its place in the result.
+		* Any byte is a safe cut, since encode puts a separator after every byte except the last one. Only the separators at the cuts are written here.
+		*/
+		std::string encode_parallel(std::string_view text, parallel_options options = {}) const
+		{
+			size_t chunks = options.chunk_count(text.size());
+			if (chunks == 1)
+				return encode(text);
+			const auto& table = m_tables->encode;
+
+			auto chunk = [&](size_t i) { return text.substr(i * text.size() / chunks, (i + 1) * text.size() / chunks - i * text.size() / chunks); };
+
+			std::vector<size_t> offsets(chunks + 1, 0);
+			detail::parallel_for(chunks, static_cast<unsigned>(chunks), [&](size_t i) { offsets[i + 1] = detail::encoded_size(chunk(i), table) + 1; });
+			for (size_t i = 0; i < chunks; ++i)
+				offsets[i + 1] += offsets[i];
+
+			std::string result(offsets[chunks] - 1, ' ');
+			detail::parallel_for(chunks, static_cast<unsigned>(chunks), [&](size_t i) { detail::encode_to(chunk(i), table, result.data() + offsets[i]); });
+			THUG_STATS(detail::thread_stats().bytes_out += chunks - 1;) // the separators at the cuts
+			return result;
+		}
+
+		/*
+		* @brief Same output as decode, computed on several threads.
+		* The morse is cut into chunks at whitespace, so no token is split. The chunks are decoded in parallel and joined in order.
+		*/
+		std::string decode_parallel(std::string_view morse, parallel_options options = {}) const
+		{
+			size_t chunks = options.chunk_count(morse.size());
+			if (chunks == 1)
+				return decode(morse);
+			const auto& classes = m_tables->key_classes;
+
+			std::vector<size_t> cuts(chunks + 1, morse.size());
+			cuts[0] = 0;
+			for (size_t i = 1; i < chunks; ++i)
+			{
+				size_t cut = std::max(cuts[i - 1], i * morse.size() / chunks);
+				while (cut < morse.size() && classes[morse[cut]] != detail::key_class::separator)
+					++cut;
+				cuts[i] = cut;
+			}
+
+			std::vector<size_t> written(chunks, 0);
+			std::string result(detail::decoded_size_upper_bound(morse) + chunks, '\0');
+			// Each chunk gets room for its own upper bound. The bounds of the chunks before it add up to at most the bound of their total plus one per chunk.
+			auto chunk_start = [&](size_t i) { return result.data() + detail::decoded_size_upper_bound(std::string_view(morse.data(), cuts[i])) + i; };
+			detail::parallel_for(chunks, static_cast<unsigned>(chunks), [&](size_t i)
+				{
+					std::string_view part(morse.data() + cuts[i], cuts[i + 1] - cuts[i]);
+					char* start = chunk_start(i);
+					written[i] = static_cast<size_t>(detail::decode_to(part, classes, start) - start);
+				});
+
+			size_t size = 0;
+			for (size_t i = 0; i < chunks; ++i)
+			{
+				std::memmove(result.data() + size, chunk_start(i), written[i]);
+				size += written[i];
+			}
+			result.resize(size);
+			return result;
+		}
+
+		/*
+		* @brief Encodes every message of a random access range (of anything convertible to std::string_view) into one batch.
+		* Each message gives the same result as encode. The sizes are counted first, so the data buffer is allocated once.
+		* With options the messages are split into contiguous groups converted on several threads. The default keeps small batches serial.
+		* out is overwritten and its capacity reused.
+		*/
+		template <typename Range>
+		void encode_batch(const Range& texts, morse_batch& out, parallel_options options = {}) const
+		{
+			auto first = std::begin(texts);
+			size_t count = static_cast<size_t>(std::distance(first, std::end(texts)));
+			auto text = [&](size_t i) { return std::string_view(first[static_cast<std::ptrdiff_t>(i)]); };
+
+			size_t total = 0;
+			for (size_t i = 0; i < count; ++i)
+				total += text(i).size();
+			size_t groups = std::min(count, options.chunk_count(total));
+			auto group_first = [&](size_t g) { return g * count / std::max<size_t>(groups, 1); };
+
+			out.offsets.assign(count + 1, 0);
+			detail::parallel_for(groups, static_cast<unsigned>(groups), [&](size_t g)
+				{
+					for (size_t i = group_first(g); i < group_first(g + 1); ++i)
+						out.offsets[i + 1] = encoded_size(text(i));
+				});
+			for (size_t i = 0; i < count; ++i)
+				out.offsets[i + 1] += out.offsets[i];
+
+			out.data.resize(out.offsets[count]);
+			detail::parallel_for(groups, static_cast<unsigned>(groups), [&](size_t g)
+				{
+					for (size_t i = group_first(g); i < group_first(g + 1); ++i)
+						detail::encode_to(text(i), m_tables->encode, out.data.data() + out.offsets[i]);
+				});
+		}
+
+		template <typename Range>
+		morse_batch encode_batch(const Range& texts, parallel_options options = {}) const
+		{
+			morse_batch result;
+			encode_batch(texts, result, options);
+			return result;
+		}
+
+		/*
+		* @brief Decodes every message of a random access range (of anything convertible to std::string_view) into one batch.
+		* Each message gives the same result as decode. Messages are decoded into slots sized by their upper bounds, then packed together.
+		* With options the messages are split into contiguous groups converted on several threads. The default keeps small batches serial.
+		* out is overwritten and its capacity reused.
+		*/
+		template <typename Range>
+		void decode_batch(const Range& morse_texts, morse_batch& out, parallel_options options = {}) const
+		{
+			auto first = std::begin(morse_texts);
+			size_t count = static_cast<size_t>(std::distance(first, std::end(morse_texts)));
+			auto morse = [&](size_t i) { return std::string_view(first[static_cast<std::ptrdiff_t>(i)]); };
+
+			out.offsets.assign(count + 1, 0);
+			for (size_t i = 0; i < count; ++i)
+				out.offsets[i + 1] = out.offsets[i] + decoded_size_upper_bound(morse(i));
+			size_t groups = std::min(count, options.chunk_count(out.offsets[count] * 2));
+			auto group_first = [&](size_t g) { return g * count / std::max<size_t>(groups, 1); };
+
+			// Until the outputs are packed, offsets[i] is where the slot of message i starts.
+			out.data.resize(out.offsets[count]);
+			std::vector<size_t>& slots = out.offsets;
+			std::vector<size_t> sizes(count, 0);
+			detail::parallel_for(groups, static_cast<unsigned>(groups), [&](size_t g)
+				{
+					for (size_t i = group_first(g); i < group_first(g + 1); ++i)
+					{
+						char* start = out.data.data() + slots[i];
+						sizes[i] = static_cast<size_t>(detail::decode_to(morse(i), m_tables->key_classes, start) - start);
+					}
+				});
+
+			size_t size = 0;
+			for (size_t i = 0; i < count; ++i)
+			{
+				std::memmove(out.data.data() + size, out.data.data() + slots[i], sizes[i]);
+				slots[i] = size;
+				size += sizes[i];
+			}
+			slots[count] = size;
+			out.data.resize(size);
+		}
+
+		template <typename Range>
+		morse_batch decode_batch(const Range& morse_texts, parallel_options options = {}) const
+		{
+			morse_batch result;
+			decode_batch(morse_texts, result, options);
+			return result;
+		}
+
+		std::string encode_file(const std::string& file) const
+		{
+			std::ifstream istr(file);
+			std::string result;
+			if (istr.is_open())
+			{
+				morse_stream_encoder encoder(m_format, [&result](std::string_view out) { result += out; });
+				detail::push_all(istr, encoder);
+			}
+			return result;
+		}
+
+		std::string decode_file(const std::string& file) const
+		{
+			std::ifstream istr(file);
+			std::string result;
+			if (istr.is_open())
+			{
+				morse_stream_decoder decoder(m_format, [&result](std::string_view out) { result += out; });
+				detail::push_all(istr, decoder);
+			}
+			return result;
+		}
+
+		// Encodes the file at in_path straight into the file at out_path. Returns false, leaving both untouched, if they are the same file,
+		// and false if either file can't be opened or written.
+		bool encode_file_to(const std::string& in_path, const std::string& out_path) const
+		{
+			const auto& table = m_tables->encode;
+			return detail::convert_file_to<morse_stream_encoder>(in_path, out_path, m_format,
+				[&](std::string_view text) { return detail::encoded_size(text, table); },
+				[&](std::string_view text, char* out) { return detail::encode_to(text, table, out); });
+		}
+
+		// Decodes the file at in_path straight into the file at out_path. Returns false, leaving both untouched, if they are the same file,
+		// and false if either file can't be opened or written.
+		bool decode_file_to(const std::string& in_path, const std::string& out_path) const
+		{
+			const auto& classes = m_tables->key_classes;
+			return detail::convert_file_to<morse_stream_decoder>(in_path, out_path, m_format,
+				[](std::string_view morse) { return detail::decoded_size_upper_bound(morse); },
+				[&](std::string_view morse, char* out) { return detail::decode_to(morse, classes, out); });
+		}
+
+		/*
+		* @brief Encodes or decodes many files on a pool of threads and writes the results under options.output_directory.
+		* Files are scheduled largest first with work stealing, and each thread asks the OS to read its next file while it converts the current one.
+		* Errors are reported per file instead of stopping the job. A missing input is an error, not an empty output.
+		*/
+		file_job_result convert_files(const std::vector<std::string>& inputs, const file_job_options& options = {}) const
+		{
+			if (options.direction == conversion_direction::encode)
+				return detail::run_file_job(inputs, options, [this](const std::string& in, const std::string& out) { return encode_file_to(in, out); });
+			return detail::run_file_job(inputs, options, [this](const std::string& in, const std::string& out) { return decode_file_to(in, out); });
+		}
+
+		// convert_files over the regular files directly in directory. A directory that can't be listed is reported as an error for the directory itself.
+		file_job_result convert_directory(const std::string& directory, const file_job_options& options = {}) const
+		{
+			std::vector<std::string> inputs;
+			std::error_code ec;
+			for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+			{
+				if (it->is_regular_file(ec))
+					inputs.push_back(it->path().string());
+			}
+			if (ec)
+			{
+				file_job_result result;
+				result.errors.push_back({ directory, "can't list the directory" });
+				return result;
+			}
+			std::sort(inputs.begin(), inputs.end());
+			return convert_files(inputs, options);
+		}
+
+		std::string default_to_member(std::string_view morse_text) const
+		{
+			return switch_format(morse_text, default_format, m_format);
+		}
+
+		std::string member_to_default(std::string_view morse_text) const
+		{
+			return switch_format(morse_text, m_format, default_format);
+		}
+
+		std::string switch_format_to_member(std::string_view morse_text, morse_format fmt) const
+		{
+			return switch_format(morse_text, fmt, m_format);
+		}
+
+		std::string switch_format_from_member(std::string_view morse_text, morse_format fmt) const
+		{
+			return switch_format(morse_text, m_format, fmt);
+		}
+
+		std::string switch_format_to_member(std::string_view morse_text, char lpk, char spk, char sk) const
+		{
+			return switch_format(morse_text, { lpk, spk, sk }, m_format);
+		}
+
+		std::string switch_format_from_member(std::string_view morse_text, char lpk, char spk, char sk) const
+		{
+			return switch_format(morse_text, m_format, { lpk, spk, sk });
+		}
+
+		static std::string switch_format(std::string_view morse_text, morse_format old_fmt, morse_format new_fmt)
+		{
+			if (old_fmt == new_fmt)
+				return std::string(morse_text);
+			// Characters that are not keys are copied as they are. If the morse_text parameter is incorrect, the output has the same error in the same place.
+			// Doesn't bother to repair. If you want to repair it, use repair_morse.
+			std::string result(morse_text.size(), '\0');
+			detail::switch_keys(morse_text.data(), result.data(), morse_text.size(), old_fmt, new_fmt);
+			return result;
+		}
+
+		static std::string switch_format(std::string_view morse_text, char old_fmt_lpk, char old_fmt_spk, char old_fmt_sk, char new_fmt_lpk, char new_fmt_spk, char new_fmt_sk)
+		{
+			return switch_format(morse_text, { old_fmt_lpk, old_fmt_spk, old_fmt_sk }, { new_fmt_lpk, new_fmt_spk, new_fmt_sk });
+		}
+
+		/*
+		* @brief The remove_incorrect_letter and try_ordered_repair_list_one_by_one options are ignored in this list. 
+		* Other repair modes can be placed in any order. The user is free to choose which repair modes to include.
+		* 
+		*	Default order:
+		*	1- remove_incorrect_key
+		*	2- try_replacing_with_short_press
+		*	3- try_replacing_with_long_press
+		*/
+		static void set_repair_order(std::initializer_list<repair_mode> new_order)
+		{
+			detail::global_repair_policy().store(repair_policy(new_order));
+		}
+
+		// The order set by set_repair_order, with the default max_distance.
+		static repair_policy get_repair_order()
+		{
+			return detail::global_repair_policy().load();
+		}
+
+		// The policy repair and decode_repaired use. A converter starts with the default policy; set_repair_order doesn't change it.
+		void set_repair_policy(const repair_policy& policy) noexcept
+		{
+			m_repair_policy = policy;
+		}
+
+		const repair_policy& get_repair_policy() const noexcept
+		{
+			return m_repair_policy;
+		}
+
+		// repair_morse with the format and the repair policy of this converter.
+		std::string repair(std::string_view morse_text, repair_mode mode = repair_mode::default_mode) const
+		{
+			std::string result;
+			repair_with_tables(morse_text, result, mode, m_repair_policy, *m_tables);
+			return result;
+		}
+
+		// repair_and_decode with the format and the repair policy of this converter.
+		std::string decode_repaired(std::string_view morse_text, repair_mode mode = repair_mode::default_mode, std::vector<token_diagnostic>* diagnostics = nullptr) const
+		{
+			return repair_and_decode_with_tables(morse_text, mode, m_repair_policy, *m_tables, diagnostics);
+		}
+
+		/*
+		* @brief max_distance is only used by try_nearest_valid_code: a letter further than this many edits from every valid code is removed.
+		* It is clamped to 8.
+		*/
+		static std::string repair_morse(std::string_view morse_text, repair_mode mode = repair_mode::default_mode, morse_format fmt = default_format, size_t max_distance = 2)
+		{
+			std::string result;
+			repair_morse_into(morse_text, result, mode, fmt, max_distance);
+			return result;
+		}
+
+		// Same as repair_morse, with the order and max_distance of policy instead of the ones set by set_repair_order.
+		static std::string repair_morse(std::string_view morse_text, repair_mode mode, const repair_policy& policy, morse_format fmt = default_format)
+		{
+			std::string result;
+			repair_morse_into(morse_text, result, mode, policy, fmt);
+			return result;
+		}
+
+#ifdef THUG_HAS_PMR
+		// Same as repair_morse, with the result and the scratch letter allocated from resource.
+		static std::pmr::string repair_morse(std::string_view morse_text, std::pmr::memory_resource* resource, repair_mode mode = repair_mode::default_mode, morse_format fmt = default_format, size_t max_distance = 2)
+		{
+			std::pmr::string result(resource);
+			repair_morse_into(morse_text, result, mode, fmt, max_distance);
+			return result;
+		}
+#endif // THUG_HAS_PMR
+
+		// Replaces the contents of out with repair_morse(morse_text, mode, fmt, max_distance). The scratch letter uses the allocator of out.
+		template <typename Allocator>
+		static void repair_morse_into(std::string_view morse_text, std::basic_string<char, std::char_traits<char>, Allocator>& out, repair_mode mode = repair_mode::default_mode, morse_format fmt = default_format, size_t max_distance = 2)
+		{
+			repair_morse_into(morse_text, out, mode, current_repair_policy(mode, max_distance), fmt);
+		}
+
+		template <typename Allocator>
+		static void repair_morse_into(std::string_view morse_text, std::basic_string<char, std::char_traits<char>, Allocator>& out, repair_mode mode, const repair_policy& policy, morse_format fmt = default_format)
+		{
+			repair_with_tables(morse_text, out, mode, policy, *detail::get_tables(fmt));
+		}
+
+		/*
+		* @brief Same text as decode(repair_morse(morse_text, mode, fmt, max_distance)), in one pass without the repaired morse in between.
+		* Each token is decoded as it is found and only the ones that fail go through repair. If diagnostics is given, it is cleared and
+		* gets one entry for every token that was not valid as it stood, whether it was repaired or removed.
+		*/
+		static std::string repair_and_decode(std::string_view morse_text, repair_mode mode = repair_mode::default_mode, morse_format fmt = default_format, size_t max_distance = 2,
+			std::vector<token_diagnostic>* diagnostics = nullptr)
+		{
+			return repair_and_decode(morse_text, mode, current_repair_policy(mode, max_distance), fmt, diagnostics);
+		}
+
+		static std::string repair_and_decode(std::string_view morse_text, repair_mode mode, const repair_policy& policy, morse_format fmt = default_format,
+			std::vector<token_diagnostic>* diagnostics = nullptr)
+		{
+			return repair_and_decode_with_tables(morse_text, mode, policy, *detail::get_tables(fmt), diagnostics);
+		}
+
+		static bool is_valid_morse(std::string_view morse_text, morse_format fmt = default_format)
+		{
+			THUG_STATS_TIMER(conversion_stage::validate);
+			THUG_STATS(detail::thread_stats().bytes_in += morse_text.size();)
+			if (!detail::only_keys_and_whitespace(morse_text, fmt))
+				return false;
+
+			auto tables = detail::get_tables(fmt);
+			for (std::string_view letter : detail::token_range(morse_text))
+				if (!tables->is_valid(letter))
+					return false;
+
+			return true;
+		}
+	private:
+		// repair_morse_into with the tables of the format already at hand, so converters don't go through the table cache on every call.
+		template <typename Allocator>
+		static void repair_with_tables(std::string_view morse_text, std::basic_string<char, std::char_traits<char>, Allocator>& out, repair_mode mode, const repair_policy& policy,
+			const detail::morse_tables& tables)
+		{
+			THUG_STATS_TIMER(conversion_stage::repair);
+			out.clear();
+			auto add_to_stream = [&](std::string_view letter, bool add_space)
+				{
+					out += letter;
+					if (add_space)
+						out += ' ';
+				};
+
+			std::basic_string<char, std::char_traits<char>, Allocator> fixed_letter(out.get_allocator());
+			detail::token_range tokens(morse_text);
+			for (auto it = tokens.begin(), end = tokens.end(); it != end;)
+			{
+				std::string_view letter = *it;
+				bool add_space = ++it != end;
+				THUG_STATS(++detail::thread_stats().tokens;)
+				repair_mode used = mode;
+				if (tables.is_valid(letter))
+					add_to_stream(letter, add_space);
+				else if (repair_letter(letter, mode, tables, policy, fixed_letter, used))
+					add_to_stream(fixed_letter, add_space);
+			}
+			THUG_STATS(auto& stats = detail::thread_stats(); stats.bytes_in += morse_text.size(); stats.bytes_out += out.size();)
+		}
+
+		// repair_and_decode with the tables of the format already at hand.
+		static std::string repair_and_decode_with_tables(std::string_view morse_text, repair_mode mode, const repair_policy& policy, const detail::morse_tables& tables,
+			std::vector<token_diagnostic>* diagnostics)
+		{
+			THUG_STATS_TIMER(conversion_stage::repair);
+			if (diagnostics != nullptr)
+				diagnostics->clear();
+
+			std::string result(decoded_size_upper_bound(morse_text), '\0');
+			char* out = result.data();
+			std::string fixed_letter;
+			for (std::string_view letter : detail::token_range(morse_text))
+			{
+				THUG_STATS(++detail::thread_stats().tokens;)
+				char decoded = tables.decode_token(letter);
+				if (decoded == '\0')
+				{
+					repair_mode used = mode;
+					bool repaired = repair_letter(letter, mode, tables, policy, fixed_letter, used);
+					if (repaired)
+						decoded = tables.decode_token(fixed_letter);
+					if (diagnostics != nullptr)
+						diagnostics->push_back({ static_cast<size_t>(letter.data() - morse_text.data()), letter, decoded, repaired, used });
+				}
+				if (decoded != '\0')
+					*out++ = decoded;
+			}
+			result.resize(static_cast<size_t>(out - result.data()));
+			THUG_STATS(auto& stats = detail::thread_stats(); stats.bytes_in += morse_text.size(); stats.bytes_out += result.size();)
+			return result;
+		}
+
+		// Repairs an invalid letter with mode, or with the modes of the repair order in turn. Returns false if the letter is to be removed.
+		template <typename String>
+		static bool repair_letter(std::string_view letter, repair_mode mode, const detail::morse_tables& tables, const repair_policy& policy, String& fixed_letter, repair_mode& used)
+		{
+			bool repaired = false;
+			if (mode == repair_mode::try_ordered_repair_list_one_by_one)
+			{
+				for (repair_mode rm : policy)
+				{
+					if (try_repair(letter, rm, tables, policy.max_distance(), fixed_letter))
+					{
+						used = rm;
+						repaired = true;
+						break;
+					}
+				}
+			}
+			else if (try_repair(letter, mode, tables, policy.max_distance(), fixed_letter))
+			{
+				used = mode;
+				repaired = true;
+			}
+			THUG_STATS(auto& stats = detail::thread_stats(); if (repaired) ++stats.repairs[static_cast<size_t>(used)]; else ++stats.removed_letters;)
+			return repaired;
+		}
+
+		// Applies one repair mode to an invalid letter. Returns false if the mode can't repair letters on its own or the result is still not valid.
+		template <typename String>
+		static bool try_repair(std::string_view letter, repair_mode mode, const detail::morse_tables& tables, size_t max_distance, String& fixed_letter)
+		{
+			morse_format fmt = tables.format;
+			switch (mode)
+			{
+			case thug::repair_mode::remove_incorrect_key:
+			{
+				// Let's remove irrelevant keys.
+				fixed_letter = letter;
+				fixed_letter.erase(std::remove_if(fixed_letter.begin(), fixed_letter.end(),
+					[fmt](char c) {
+						return !fmt.is_key(c);
+					}),
+					fixed_letter.end());
+				break;
+			}
+			case thug::repair_mode::try_replacing_with_short_press:
+			{
+				// Let's replace the incorrect keys with short_press key
+				fixed_letter = letter;
+				for (auto& key : fixed_letter)
+					if (!fmt.is_key(key))
+						key = fmt.short_press;
+				break;
+			}
+			case thug::repair_mode::try_replacing_with_long_press:
+			{
+				// Let's replace the incorrect keys with long_press key
+				fixed_letter = letter;
+				for (auto& key : fixed_letter)
+					if (!fmt.is_key(key))
+						key = fmt.long_press;
+				break;
+			}
+			case thug::repair_mode::try_nearest_valid_code:
+			{
+				return detail::nearest_code_search(letter, fmt, max_distance).find(fixed_letter); // always a valid code when found
+			}
+			default:
+				return false; // remove_incorrect_letter and try_ordered_repair_list_one_by_one can't repair a letter by themselves.
+			}
+
+			return tables.is_valid(fixed_letter);
+		}
+
+		// The order set by set_repair_order is only needed by try_ordered_repair_list_one_by_one, so other modes don't take the lock.
+		static repair_policy current_repair_policy(repair_mode mode, size_t max_distance)
+		{
+			if (mode == repair_mode::try_ordered_repair_list_one_by_one)
+				return detail::global_repair_policy().load().with_max_distance(max_distance);
+			return repair_policy(max_distance);
+		}
+
+		void load_tables()
+		{
+			m_tables = detail::get_tables(m_format);
+		}
+
+		morse_format m_format;
+		detail::morse_tables_handle m_tables;
+		repair_policy m_repair_policy;
+		};
+
+	/*
+	* @brief A converter whose format is fixed at compile time.
+	* Its tables are built by the compiler, so constructing one costs nothing and encode/decode only index flat arrays.
+	* Use morse_converter when the format is only known at runtime. Both give the same results for the same format.
+	*/
+	template <char LongPressKey = default_format.long_press, char ShortPressKey = default_format.short_press, char SpaceKey = default_format.space>
+	class basic_morse_converter
+	{
+	public:
+		static constexpr morse_format format{ LongPressKey, ShortPressKey, SpaceKey };
+
+		// text to morse
+		std::string encode(std::string_view text) const
+		{
+			std::string result(detail::encoded_size(text, s_encode_table), ' ');
+			detail::encode_to(text, s_encode_table, result.data());
+			return result;
+		}
+
+		// morse to text
+		std::string decode(std::string_view morse) const
+		{
+			std::string result(detail::decoded_size_upper_bound(morse), '\0');
+			result.resize(static_cast<size_t>(detail::decode_to(morse, s_key_classes, result.data()) - result.data()));
+			return result;
+		}
+	private:
+		static constexpr detail::encode_table s_encode_table = detail::make_encode_table(format);
+		static constexpr detail::key_class_table s_key_classes = detail::make_key_class_table(format);
+	};
+
+	namespace detail
+	{
+		/*
+		* Morse archive: text encoded as binary morse in chunks that each decode on their own, followed by an index and a trailer.
+		* Chunk i is a complete binary morse blob (see binary_magic). The index has one entry per chunk and one past the last,
+		* each the offset in the decoded text and the offset in the file as little endian 64 bit numbers. The trailer is the magic
+		* "THGA", a version byte, three zero bytes and the chunk count, so a reader finds the index from the end of the file.
+		*/
+		constexpr char archive_magic[4] = { 'T', 'H', 'G', 'A' };
+		constexpr uint8_t archive_version = 1;
+		constexpr size_t archive_trailer_size = 16;
+		constexpr size_t archive_entry_size = 16;
+
+		// Bytes of decode(encode(text, alphabet), alphabet): the letters the alphabet knows, in the form it decodes them to.
+		inline uint64_t decoded_text_size(std::string_view text, const morse_alphabet& alphabet) noexcept
+		{
+			uint64_t size = 0;
+			for_each_letter_code(text, alphabet, [&](uint8_t code) { size += code != 0 ? utf8_size(alphabet.letters[code]) : 0; });
+			return size;
+		}
+
+		// The longest prefix of text that doesn't end inside a UTF-8 sequence, or all of it if the sequence starts the text.
+		inline size_t utf8_prefix_size(std::string_view text) noexcept
+		{
+			size_t start = text.size();
+			while (start > 0 && text.size() - start < 4)
+				if ((static_cast<uint8_t>(text[--start]) & 0xC0) != 0x80)
+					break;
+			if (start == text.size())
+				return start;
+			uint8_t lead = static_cast<uint8_t>(text[start]);
+			size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+			return start > 0 && start + length > text.size() ? start : text.size();
+		}
+	}
+
+	/*
+	* @brief Writes text to a morse archive (described at detail::archive_magic) that morse_archive_reader can decode a slice of
+	* without reading the rest. Text is pushed in pieces of any size and cut into chunks of chunk_size bytes, never inside a
+	* UTF-8 sequence. Call finish() to write the index; the destructor does it if it wasn't called.
+	*/
+	class morse_archive_writer
+	{
+	public:
+		static constexpr size_t default_chunk_size = 16384;
+
+		explicit morse_archive_writer(const std::string& path, const morse_alphabet& alphabet = latin_alphabet, size_t chunk_size = default_chunk_size)
+			: m_file(path, std::ios::binary | std::ios::trunc), m_alphabet(&alphabet), m_chunk_size(std::max<size_t>(chunk_size, 4))
+		{
+		}
+
+		morse_archive_writer(const morse_archive_writer&) = delete;
+		morse_archive_writer& operator=(const morse_archive_writer&) = delete;
+
+		~morse_archive_writer()
+		{
+			if (!m_finished)
+				finish();
+		}
+
+		// False if the file could not be opened or a write failed.
+		explicit operator bool() const
+		{
+			return static_cast<bool>(m_file);
+		}
+
+		bool push(std::string_view text)
+		{
+			if (m_finished)
+				return false;
+			while (!text.empty())
+			{
+				if (m_pending.empty() && text.size() >= m_chunk_size)
+				{
+					size_t size = detail::utf8_prefix_size(text.substr(0, m_chunk_size));
+					write_chunk(text.substr(0, size));
+					text.remove_prefix(size);
+					continue;
+				}
+				size_t size = std::min(text.size(), m_chunk_size - m_pending.size());
+				m_pending.append(text.data(), size);
+				text.remove_prefix(size);
+				if (m_pending.size() == m_chunk_size)
+				{
+					size_t chunk = detail::utf8_prefix_size(m_pending);
+					write_chunk(std::string_view(m_pending).substr(0, chunk));
+					m_pending.erase(0, chunk);
+				}
+			}
+			return static_cast<bool>(m_file);
+		}
+
+		// Writes the last chunk, the index and the trailer, and closes the file. Returns false if anything could not be written.
+		bool finish()
+		{
+			if (m_finished)
+				return static_cast<bool>(m_file);
+			m_finished = true;
+			write_chunk(m_pending);
+			m_pending.clear();
+
+			size_t chunks = m_index.size() / 2;
+			m_index.push_back(m_text_size);
+			m_index.push_back(m_file_size);
+			std::string footer(m_index.size() * 8 + detail::archive_trailer_size, '\0');
+			for (size_t i = 0; i < m_index.size(); ++i)
+				detail::store_le64(&footer[i * 8], m_index[i]);
+			char* trailer = &footer[m_index.size() * 8];
+			std::memcpy(trailer, detail::archive_magic, 4);
+			trailer[4] = static_cast<char>(detail::archive_version);
+			detail::store_le64(trailer + 8, chunks);
+			m_file.write(footer.data(), static_cast<std::streamsize>(footer.size()));
+			m_file.close();
+			return static_cast<bool>(m_file);
+		}
+	private:
+		void write_chunk(std::string_view text)
+		{
+			if (text.empty())
+				return;
+			std::string blob = morse_converter::encode_binary(text, *m_alphabet);
+			m_index.push_back(m_text_size);
+			m_index.push_back(m_file_size);
+			m_file.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+			m_text_size += detail::decoded_text_size(text, *m_alphabet);
+			m_file_size += blob.size();
+		}
+
+		std::ofstream m_file;
+		const morse_alphabet* m_alphabet;
+		size_t m_chunk_size;
+		std::string m_pending;
+		std::vector<uint64_t> m_index; // text offset and file offset of every chunk, one after the other
+		uint64_t m_text_size = 0;
+		uint64_t m_file_size = 0;
+		bool m_finished = false;
+	};
+
+	/*
+	* @brief Decodes slices of a morse archive written by morse_archive_writer. Only the chunks that overlap the slice are decoded,
+	* so the cost of a read depends on its length and the chunk size, not on the size of the archive.
+	* The file is mapped where mmap is available and read into memory otherwise. read can be called from several threads at once.
+	*/
+	class morse_archive_reader
+	{
+	public:
+		explicit morse_archive_reader(const std::string& path, const morse_alphabet& alphabet = latin_alphabet) : m_alphabet(&alphabet)
+		{
+#ifdef THUG_HAS_MMAP
+			detail::unique_fd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+			size_t size = 0;
+			if (fd.get() < 0 || !detail::regular_file_size(fd.get(), size) || size == 0)
+				return;
+			m_file = detail::mapped_file(fd.get(), size, PROT_READ, MAP_PRIVATE);
+			if (!m_file)
+				return;
+			::madvise(m_file.data(), m_file.size(), MADV_RANDOM);
+#else // THUG_HAS_MMAP
+			std::ifstream file(path, std::ios::binary);
+			if (!file.is_open())
+				return;
+			m_file.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+#endif // THUG_HAS_MMAP
+			if (!load_index())
+				m_index.clear();
+		}
+
+		// False if the file could not be read or is not a morse archive.
+		explicit operator bool() const noexcept
+		{
+			return !m_index.empty();
+		}
+
+		// Bytes of decoded text in the archive.
+		uint64_t size() const noexcept
+		{
+			return m_index.empty() ? 0 : m_index.back().text_offset;
+		}
+
+		size_t chunk_count() const noexcept
+		{
+			return m_index.empty() ? 0 : m_index.size() - 1;
+		}
+
+		/*
+		* @brief Replaces text with the decoded bytes [offset, offset + length), cut short at the end of the archive.
+		* Offsets count bytes, so a slice can start or end inside a multibyte letter. Returns false, leaving text empty,
+		* if the archive could not be opened or a chunk in the slice is damaged.
+		*/
+		bool read(uint64_t offset, uint64_t length, std::string& text) const
+		{
+			text.clear();
+			if (m_index.empty())
+				return false;
+			uint64_t end = offset + std::min(length, size() - std::min(offset, size()));
+			if (offset >= end)
+				return true;
+
+			std::string_view contents = data();
+			auto entry = std::upper_bound(m_index.begin(), m_index.end() - 1, offset, [](uint64_t value, const index_entry& e) { return value < e.text_offset; }) - 1;
+			std::string chunk;
+			for (; entry != m_index.end() - 1 && entry->text_offset < end; ++entry)
+			{
+				auto next = entry + 1;
+				std::string_view blob = contents.substr(static_cast<size_t>(entry->file_offset), static_cast<size_t>(next->file_offset - entry->file_offset));
+				if (!morse_converter::decode_binary(blob, chunk, *m_alphabet) || chunk.size() != next->text_offset - entry->text_offset)
+				{
+					text.clear();
+					return false;
+				}
+				size_t from = static_cast<size_t>(std::max(offset, entry->text_offset) - entry->text_offset);
+				size_t to = static_cast<size_t>(std::min(end, next->text_offset) - entry->text_offset);
+				text.append(chunk, from, to - from);
+			}
+			return true;
+		}
+
+		std::string read(uint64_t offset, uint64_t length) const
+		{
+			std::string text;
+			read(offset, length, text);
+			return text;
+		}
+	private:
+		struct index_entry
+		{
+			uint64_t text_offset;
+			uint64_t file_offset;
+		};
+
+		std::string_view data() const noexcept
+		{
+			return std::string_view(m_file.data(), m_file.size());
+		}
+
+		// Reads the trailer and the index, and checks that the offsets rise and the chunks end where the index starts.
+		bool load_index()
+		{
+			std::string_view contents = data();
+			if (contents.size() < detail::archive_trailer_size)
+				return false;
+			const char* trailer = contents.data() + contents.size() - detail::archive_trailer_size;
+			if (std::memcmp(trailer, detail::archive_magic, 4) != 0 || static_cast<uint8_t>(trailer[4]) != detail::archive_version)
+				return false;
+			uint64_t chunks = detail::load_le64(trailer + 8);
+			uint64_t room = (contents.size() - detail::archive_trailer_size) / detail::archive_entry_size;
+			if (chunks >= room)
+				return false;
+
+			uint64_t index_offset = contents.size() - detail::archive_trailer_size - (chunks + 1) * detail::archive_entry_size;
+			const char* index = contents.data() + index_offset;
+			m_index.resize(static_cast<size_t>(chunks + 1));
+			for (size_t i = 0; i < m_index.size(); ++i)
+			{
+				m_index[i] = { detail::load_le64(index + i * detail::archive_entry_size), detail::load_le64(index + i * detail::archive_entry_size + 8) };
+				if (i == 0 ? m_index[i].text_offset != 0 || m_index[i].file_offset != 0
+					: m_index[i].text_offset < m_index[i - 1].text_offset || m_index[i].file_offset <= m_index[i - 1].file_offset)
+					return false;
+			}
+			return m_index.back().file_offset == index_offset;
+		}
+
+#ifdef THUG_HAS_MMAP
+		detail::mapped_file m_file;
+#else // THUG_HAS_MMAP
+		std::string m_file;
+#endif // THUG_HAS_MMAP
+		const morse_alphabet* m_alphabet;
+		std::vector<index_entry> m_index; // one entry per chunk and one for the end
+	};
+
+	struct synthesis_options
+	{
+		double wpm = 20.0; // character speed, measured with the word PARIS (50 units)
+		double farnsworth_wpm = 0.0; // overall speed with Farnsworth spacing. 0, or anything not below wpm, turns it off
+		unsigned sample_rate = 48000;
+		double tone_frequency = 700.0; // Hz
+		double rise_time = 0.005; // seconds of raised-cosine edge at each end of a tone, clamped to half a unit
+		float amplitude = 0.8f; // peak level, 1.0 being full scale
+	};
+
+	// Element and gap lengths in samples.
+	struct morse_timing
+	{
+		size_t unit = 0; // a dit, and the gap between the keys of a letter
+		size_t dah = 0; // 3 units
+		size_t letter_gap = 0; // 3 units, longer with Farnsworth spacing
+		size_t word_gap = 0; // 7 units, longer with Farnsworth spacing
+
+		static morse_timing from(const synthesis_options& options) noexcept
+		{
+			morse_timing result;
+			double unit_seconds = 1.2 / options.wpm;
+			result.unit = static_cast<size_t>(std::lround(unit_seconds * options.sample_rate));
+			result.dah = 3 * result.unit;
+			result.letter_gap = 3 * result.unit;
+			result.word_gap = 7 * result.unit;
+
+			if (options.farnsworth_wpm > 0.0 && options.farnsworth_wpm < options.wpm)
+			{
+				// ARRL Farnsworth timing: the 19 gap units of PARIS are stretched so that the whole word takes 60 / farnsworth_wpm seconds.
+				double c = options.wpm, s = options.farnsworth_wpm;
+				double gap_unit_seconds = (60.0 * c - 37.2 * s) / (s * c) / 19.0;
+				result.letter_gap = static_cast<size_t>(std::lround(3.0 * gap_unit_seconds * options.sample_rate));
+				result.word_gap = static_cast<size_t>(std::lround(7.0 * gap_unit_seconds * options.sample_rate));
+			}
+			return result;
+		}
+	};
+
+	namespace detail
+	{
+		enum class keying_element : uint8_t
+		{
+			silence,
+			dit,
+			dah
+		};
+
+		/*
+		* @brief Turns morse text into a sequence of tones and silences.
+		* A gap is only decided when the next tone starts: a key after a key gets the unit gap, whitespace makes it a letter gap
+		* and the space key a word gap. So the output never ends with a gap, and leading gaps are dropped.
+		*/
+		class keying_parser
+		{
+		public:
+			keying_parser(const morse_timing& timing, const key_class_table& classes) noexcept : m_timing(timing), m_classes(&classes) {}
+
+			// Takes the next element out of input starting at pos. Returns false once input has no more tones.
+			bool next(std::string_view input, size_t& pos, keying_element& element, size_t& length) noexcept
+			{
+				for (; pos < input.size(); ++pos)
+				{
+					auto key = (*m_classes)[input[pos]];
+					if (key == key_class::short_press || key == key_class::long_press)
+					{
+						if (m_pending_gap != 0)
+						{
+							element = keying_element::silence;
+							length = m_pending_gap;
+							m_pending_gap = 0;
+							return true;
+						}
+						++pos;
+						m_started = true;
+						m_pending_gap = m_timing.unit;
+						element = key == key_class::short_press ? keying_element::dit : keying_element::dah;
+						length = key == key_class::short_press ? m_timing.unit : m_timing.dah;
+						return true;
+					}
+					if (!m_started)
+						continue;
+					if (key == key_class::separator)
+						m_pending_gap = std::max(m_pending_gap, m_timing.letter_gap);
+					else if (key == key_class::space)
+						m_pending_gap = std::max(m_pending_gap, m_timing.word_gap);
+				}
+				return false;
+			}
+		private:
+			morse_timing m_timing; // a copy, so a synthesizer that owns the parser can be copied and moved
+			const key_class_table* m_classes; // in tables the owner holds a handle to
+			size_t m_pending_gap = 0;
+			bool m_started = false;
+		};
+	}
+
+	/*
+	* @brief Renders morse text (in any format) as PCM audio into caller buffers.
+	* The dit and dah waveforms, edges included, are computed once on construction. Rendering only copies them and writes silence,
+	* so it runs far faster than real time. Characters that are neither keys nor whitespace are ignored.
+	*/
+	class morse_synthesizer
+	{
+	public:
+		morse_synthesizer(synthesis_options options = {}, morse_format fmt = default_format)
+			: m_options(options), m_timing(morse_timing::from(options)), m_tables(detail::get_tables(fmt)), m_parser(m_timing, m_tables->key_classes)
+		{
+			size_t ramp = std::min(static_cast<size_t>(std::lround(options.rise_time * options.sample_rate)), m_timing.unit / 2);
+			const double pi = 3.14159265358979323846;
+			const double step = 2.0 * pi * options.tone_frequency / options.sample_rate;
+
+			auto make_tone = [&](size_t length)
+				{
+					std::vector<float> tone(length);
+					for (size_t i = 0; i < length; ++i)
+					{
+						double gain = 1.0;
+						size_t edge = std::min(i, length - 1 - i);
+						if (edge < ramp)
+							gain = 0.5 - 0.5 * std::cos(pi * (edge + 0.5) / ramp);
+						tone[i] = static_cast<float>(options.amplitude * gain * std::sin(step * i));
+					}
+					return tone;
+				};
+			m_dit = make_tone(m_timing.unit);
+			m_dah = make_tone(m_timing.dah);
+		}
+
+		const morse_timing& timing() const noexcept
+		{
+			return m_timing;
+		}
+
+		const synthesis_options& options() const noexcept
+		{
+			return m_options;
+		}
+
+		// Queues morse for rendering. A letter cut between two pushes is keyed as one letter.
+		void push(std::string_view morse)
+		{
+			if (m_pos == m_input.size())
+			{
+				m_input.clear();
+				m_pos = 0;
+			}
+			m_input += morse;
+		}
+
+		/*
+		* @brief Writes up to capacity samples and returns how many were written.
+		* Returns less than capacity once the queued morse has been rendered up to its last tone. Later pushes continue from there.
+		*/
+		size_t render(float* out, size_t capacity)
+		{
+			return render_to(out, capacity, [](float sample) { return sample; });
+		}
+
+		// Same as render(float*, size_t), with samples scaled to 16-bit integers.
+		size_t render(int16_t* out, size_t capacity)
+		{
+			return render_to(out, capacity, [](float sample) { return static_cast<int16_t>(std::lround(sample * 32767.0f)); });
+		}
+
+		// Number of samples render produces for morse on its own.
+		size_t sample_count(std::string_view morse) const noexcept
+		{
+			detail::keying_parser parser(m_timing, m_tables->key_classes);
+			detail::keying_element element;
+			size_t pos = 0, length = 0, total = 0;
+			while (parser.next(morse, pos, element, length))
+				total += length;
+			return total;
+		}
+	private:
+		template <typename Sample, typename Convert>
+		size_t render_to(Sample* out, size_t capacity, Convert convert)
+		{
+			size_t written = 0;
+			while (written < capacity)
+			{
+				if (m_remaining == 0)
+				{
+					size_t length = 0;
+					if (!m_parser.next(m_input, m_pos, m_element, length))
+						break;
+					m_offset = 0;
+					m_remaining = length;
+				}
+
+				size_t count = std::min(capacity - written, m_remaining);
+				if (m_element == detail::keying_element::silence)
+				{
+					std::fill_n(out + written, count, Sample{});
+				}
+				else
+				{
+					const float* tone = (m_element == detail::keying_element::dit ? m_dit.data() : m_dah.data()) + m_offset;
+					for (size_t i = 0; i < count; ++i)
+						out[written + i] = convert(tone[i]);
+				}
+				written += count;
+				m_offset += count;
+				m_remaining -= count;
+			}
+			return written;
+		}
+
+		synthesis_options m_options;
+		morse_timing m_timing;
+		detail::morse_tables_handle m_tables;
+		detail::keying_parser m_parser;
+		std::vector<float> m_dit;
+		std::vector<float> m_dah;
+		std::string m_input;
+		size_t m_pos = 0;
+		detail::keying_element m_element = detail::keying_element::silence;
+		size_t m_offset = 0;
+		size_t m_remaining = 0;
+	};
+
+	namespace detail
+	{
+		/*
+		* @brief Turns key-down (mark) and key-up (space) durations into morse text while tracking the sender's speed.
+		* Marks are split into dits and dahs by running 2-means over the last marks, in the log domain so the 1:3 ratio counts as a distance.
+		* A space of 2 dits or more ends the letter and one of 5 dits or more ends the word. Both are written as soon as the ongoing space
+		* crosses the threshold, so the output never waits for the next mark. Durations can be in any unit, as long as it is always the same.
+		*/
+		class cw_timing_tracker
+		{
+		public:
+			static constexpr size_t history_size = 16;
+
+			cw_timing_tracker(double initial_dit, morse_format fmt) noexcept : m_dit(initial_dit), m_fmt(fmt) {}
+
+			double dit() const noexcept
+			{
+				return m_dit;
+			}
+
+			void mark(double duration, std::string& out)
+			{
+				if (!(duration > 0.0))
+					return;
+				m_history[m_count++ % history_size] = duration;
+				size_t size = std::min(m_count, history_size);
+
+				double shortest = m_history[0], longest = m_history[0];
+				for (size_t i = 1; i < size; ++i)
+				{
+					shortest = std::min(shortest, m_history[i]);
+					longest = std::max(longest, m_history[i]);
+				}
+
+				double threshold = 2.0 * m_dit;
+				if (longest >= 2.0 * shortest)
+				{
+					// Both clusters are in the window: a few rounds of 2-means with the boundary at the geometric mean of the centers.
+					double dit_center = shortest, dah_center = longest;
+					for (int round = 0; round < 3; ++round)
+					{
+						threshold = std::sqrt(dit_center * dah_center);
+						double dit_sum = 0.0, dah_sum = 0.0;
+						size_t dits = 0;
+						for (size_t i = 0; i < size; ++i)
+						{
+							if (m_history[i] < threshold)
+							{
+								dit_sum += m_history[i];
+								++dits;
+							}
+							else
+							{
+								dah_sum += m_history[i];
+							}
+						}
+						if (dits == 0 || dits == size)
+							break; // one side is empty: keep the centers of the last round
+						dit_center = dit_sum / static_cast<double>(dits);
+						dah_center = dah_sum / static_cast<double>(size - dits);
+					}
+					threshold = std::sqrt(dit_center * dah_center);
+					m_dit = (dit_center + dah_center / 3.0) / 2.0;
+				}
+				else
+				{
+					// One cluster only: it is made of dahs if it is nearer 3 dits than 1, again in the log domain.
+					double mean = 0.0;
+					for (size_t i = 0; i < size; ++i)
+						mean += m_history[i];
+					mean /= static_cast<double>(size);
+					m_dit = mean > 1.7320508075688772 * m_dit ? mean / 3.0 : mean;
+					threshold = 2.0 * m_dit;
+				}
+
+				out += duration < threshold ? m_fmt.short_press : m_fmt.long_press;
+				m_in_letter = true;
+				m_in_word = true;
+			}
+
+			// Call while a space goes on, with its length so far, and once more when it ends.
+			void space(double duration, std::string& out)
+			{
+				if (m_in_letter && duration >= 2.0 * m_dit)
+				{
+					out += ' ';
+					m_in_letter = false;
+				}
+				if (m_in_word && duration >= 5.0 * m_dit)
+				{
+					out += m_fmt.space;
+					out += ' ';
+					m_in_word = false;
+				}
+			}
+
+			// Ends the current letter without waiting for a long enough space.
+			void finish(std::string& out)
+			{
+				if (m_in_letter)
+					out += ' ';
+				m_in_letter = false;
+				m_in_word = false;
+			}
+		private:
+			double m_history[history_size] = {};
+			size_t m_count = 0;
+			double m_dit;
+			morse_format m_fmt;
+			bool m_in_letter = false;
+			bool m_in_word = false;
 		};
 	}
+
+	struct demodulation_options
+	{
+		unsigned sample_rate = 48000;
+		double tone_frequency = 700.0; // Hz
+		double block_duration = 0.004; // seconds per tone detector block. Shorter blocks follow faster keying, longer ones reject more noise
+		double initial_wpm = 20.0; // the speed estimate starts here and adapts after a few letters
+		double min_snr = 8.0; // power ratio between the tracked signal and noise levels below which nothing is keyed
+	};
+
+	/*
+	* @brief Receives CW audio in blocks of any size and writes morse text (keys, whitespace and the space key) that decode can read.
+	* The tone is detected with a Goertzel filter per block. The key threshold sits between a tracked signal peak and noise floor,
+	* and key state changes shorter than a quarter dit are ignored. Durations go through cw_timing_tracker, which follows the speed.
+	* Letters are written once the following space is 2 dits long, so latency stays bounded. Per sample cost is one multiply and two adds.
+	*/
+	class morse_demodulator
+	{
+	public:
+		morse_demodulator(demodulation_options options, morse_format fmt, morse_output_callback output)
+			: m_options(options),
+			m_block_size(std::max<size_t>(1, static_cast<size_t>(std::lround(options.block_duration * options.sample_rate)))),
+			m_block_seconds(static_cast<double>(m_block_size) / options.sample_rate),
+			m_coefficient(2.0 * std::cos(2.0 * 3.14159265358979323846 * options.tone_frequency / options.sample_rate)),
+			m_tracker(1.2 / options.initial_wpm, fmt),
+			m_output(std::move(output)) {}
+
+		void push(const float* samples, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+				add_sample(samples[i]);
+			flush();
+		}
+
+		void push(const int16_t* samples, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+				add_sample(samples[i] * (1.0f / 32768.0f));
+			flush();
+		}
+
+		// Ends the current letter and flushes the output.
+		void finish()
+		{
+			if (m_key_down)
+				m_tracker.mark(m_run * m_block_seconds, m_buffer);
+			m_tracker.finish(m_buffer);
+			m_key_down = false;
+			m_run = 0;
+			m_flip = 0;
+			flush();
+		}
+
+		// The current estimate of the sender's speed.
+		double wpm() const noexcept
+		{
+			return 1.2 / m_tracker.dit();
+		}
+	private:
+		void add_sample(float sample) noexcept
+		{
+			double s0 = sample + m_coefficient * m_s1 - m_s2;
+			m_s2 = m_s1;
+			m_s1 = s0;
+			if (++m_filled == m_block_size)
+				end_block();
+		}
+
+		void end_block()
+		{
+			double power = (m_s1 * m_s1 + m_s2 * m_s2 - m_coefficient * m_s1 * m_s2) / (static_cast<double>(m_block_size) * m_block_size);
+			m_s1 = m_s2 = 0.0;
+			m_filled = 0;
+
+			// Both levels are averages with a time constant of about a second: the peak over blocks that hold the tone and the floor over
+			// the others, so neither is pulled toward the other. The peak rises quickly to catch the first mark and sinks slowly otherwise,
+			// in case the signal fades away.
+			// Within the first second the floor is the plain mean of the blocks so far, and nothing is keyed for the first 0.1 s, so one
+			// quiet block at the start can't make the noise after it look like a signal.
+			if (m_blocks++ == 0)
+				m_peak = m_floor = power;
+			bool settled = static_cast<double>(m_blocks) * m_block_seconds >= 0.1;
+			bool has_signal = settled && m_peak > m_floor * m_options.min_snr;
+			double threshold = std::sqrt(m_peak * m_floor);
+			bool raw = has_signal && power > (m_key_down ? threshold * 0.7 : threshold * 1.4);
+
+			double rate = m_block_seconds;
+			if (power > m_peak)
+				m_peak += (power - m_peak) * 0.5;
+			else
+				m_peak += (power - m_peak) * (raw ? rate : rate / 4.0);
+			if (!raw)
+				m_floor += (power - m_floor) * std::max(rate, 1.0 / static_cast<double>(m_blocks));
+			add_block(raw);
+		}
+
+		void add_block(bool raw)
+		{
+			size_t debounce = std::max<size_t>(1, static_cast<size_t>(m_tracker.dit() / m_block_seconds / 4.0));
+			if (raw == m_key_down)
+			{
+				m_run += m_flip + 1;
+				m_flip = 0;
+			}
+			else if (++m_flip >= debounce)
+			{
+				if (m_key_down)
+					m_tracker.mark(m_run * m_block_seconds, m_buffer);
+				else
+					m_tracker.space(m_run * m_block_seconds, m_buffer);
+				m_key_down = raw;
+				m_run = m_flip;
+				m_flip = 0;
+			}
+
+			if (!m_key_down && m_started)
+				m_tracker.space(m_run * m_block_seconds, m_buffer);
+			m_started = m_started || m_key_down;
+		}
+
+		void flush()
+		{
+			if (!m_buffer.empty())
+				m_output(m_buffer);
+			m_buffer.clear();
+		}
+
+		demodulation_options m_options;
+		size_t m_block_size;
+		double m_block_seconds;
+		double m_coefficient;
+		detail::cw_timing_tracker m_tracker;
+		morse_output_callback m_output;
+		std::string m_buffer;
+
+		double m_s1 = 0.0;
+		double m_s2 = 0.0;
+		size_t m_filled = 0;
+		size_t m_blocks = 0;
+		double m_peak = 0.0;
+		double m_floor = 0.0;
+
+		bool m_key_down = false;
+		bool m_started = false;
+		size_t m_run = 0; // blocks in the current key state
+		size_t m_flip = 0; // blocks in a row that disagree with it
+	};
+
+	/*
+	* @brief Decodes timestamped key-down and key-up events, as a straight key or paddle reports them, into text.
+	* Durations go through cw_timing_tracker, so dits and dahs are told apart and the speed is followed without any setup.
+	* Timestamps are in microseconds from any fixed origin. Events that don't change the key state are ignored, and so are marks and
+	* gaps shorter than a quarter of a dit, which is contact bounce: a mark is only passed on once the gap after it is long enough.
+	* Each event costs a few hundred operations. A letter is written when the next key-down shows the gap, or earlier if poll sees
+	* the gap grow long enough.
+	*/
+	class key_event_decoder
+	{
+	public:
+		key_event_decoder(double initial_wpm, morse_output_callback output)
+			: m_tables(detail::get_tables(default_format)),
+			m_tracker(1.2e6 / initial_wpm, default_format),
+			m_output(std::move(output)) {}
+
+		void key_down(uint64_t time_us)
+		{
+			if (m_key_down)
+				return;
+			m_key_down = true;
+			if (m_started)
+			{
+				double gap = elapsed(m_key_up, time_us);
+				if (m_pending_mark > 0.0 && gap < glitch())
+				{
+					// The key bounced open during a mark: the mark goes on from where it started.
+					m_pending_mark = 0.0;
+					return;
+				}
+				commit_mark();
+				m_tracker.space(gap, m_morse);
+				flush();
+			}
+			m_key_down_at = time_us;
+		}
+
+		void key_up(uint64_t time_us)
+		{
+			if (!m_key_down)
+				return;
+			m_key_down = false;
+			double mark = elapsed(m_key_down_at, time_us);
+			if (mark < glitch())
+				return; // the key bounced closed during a gap, which goes on from where it started
+			m_pending_mark = mark;
+			m_key_up = time_us;
+			m_started = true;
+		}
+
+		// Writes the current letter, and the word break, as soon as the key has been up long enough. Call it from a timer while idle.
+		void poll(uint64_t now_us)
+		{
+			if (m_key_down || !m_started)
+				return;
+			double gap = elapsed(m_key_up, now_us);
+			if (gap < glitch())
+				return;
+			commit_mark();
+			m_tracker.space(gap, m_morse);
+			flush();
+		}
+
+		// Ends the current letter. A mark still going on is dropped, since its length is unknown.
+		void finish()
+		{
+			commit_mark();
+			m_tracker.finish(m_morse);
+			m_key_down = false;
+			m_started = false;
+			flush();
+		}
+
+		// The current estimate of the operator's speed.
+		double wpm() const noexcept
+		{
+			return 1.2e6 / m_tracker.dit();
+		}
+	private:
+		// Timestamps that go backwards count as no time at all.
+		static double elapsed(uint64_t from_us, uint64_t to_us) noexcept
+		{
+			return to_us > from_us ? static_cast<double>(to_us - from_us) : 0.0;
+		}
+
+		// Shorter marks and gaps are contact bounce, as in the demodulator.
+		double glitch() const noexcept
+		{
+			return 0.25 * m_tracker.dit();
+		}
+
+		// Passes on the last mark once the gap after it has shown it was not cut short by bounce.
+		void commit_mark()
+		{
+			if (m_pending_mark > 0.0)
+				m_tracker.mark(m_pending_mark, m_morse);
+			m_pending_mark = 0.0;
+		}
+
+		// Decodes the letters the tracker has ended and hands them to the output.
+		void flush()
+		{
+			size_t end = m_morse.rfind(' ');
+			if (end == std::string::npos)
+				return;
+			detail::decode_to(std::string_view(m_morse.data(), end), m_tables->key_classes, std::back_inserter(m_text));
+			m_morse.erase(0, end + 1);
+			if (!m_text.empty())
+				m_output(m_text);
+			m_text.clear();
+		}
+
+		detail::morse_tables_handle m_tables;
+		detail::cw_timing_tracker m_tracker;
+		morse_output_callback m_output;
+		std::string m_morse;
+		std::string m_text;
+		uint64_t m_key_down_at = 0;
+		uint64_t m_key_up = 0;
+		double m_pending_mark = 0.0; // the last mark, until the gap after it is longer than a glitch
+		bool m_key_down = false;
+		bool m_started = false; // a mark has been seen, so the key up time starts a gap
+	};
+}
@@ -0,0 +1,121 @@
+/*
+* thug_convert: encodes or decodes files and directories from the command line with morse_converter::convert_files.
+*
+*	thug_convert encode|decode [--output-dir DIR] [--suffix TEXT] [--threads N] [--format LONG_SHORT_SPACE] INPUT...
+*
+* An input that is a directory stands for the regular files directly in it. Outputs are written to --output-dir, or next to each
+* input without it, with --suffix appended to the file name (".morse" when encoding and ".txt" when decoding unless given).
+* Prints a summary and one line per failed file to stderr, and exits with 1 if any file failed.
+*/
+#include "thug.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	void usage()
+	{
+		std::cerr << "usage: thug_convert encode|decode [--output-dir DIR] [--suffix TEXT] [--threads N] [--format LONG_SHORT_SPACE] INPUT...\n";
+	}
+
+	void add(thug::file_job_result& total, thug::file_job_result&& result)
+	{
+		total.files += result.files;
+		total.bytes_in += result.bytes_in;
+		total.bytes_out += result.bytes_out;
+		total.seconds += result.seconds;
+		for (auto& error : result.errors)
+			total.errors.push_back(std::move(error));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		usage();
+		return 2;
+	}
+
+	thug::file_job_options options;
+	std::string command = argv[1];
+	if (command == "encode")
+		options.direction = thug::conversion_direction::encode;
+	else if (command == "decode")
+		options.direction = thug::conversion_direction::decode;
+	else
+	{
+		usage();
+		return 2;
+	}
+	options.output_suffix = options.direction == thug::conversion_direction::encode ? ".morse" : ".txt";
+
+	thug::morse_format fmt = thug::default_format;
+	std::vector<std::string> inputs;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		bool ok = true;
+		if (arg == "--output-dir" && has_value)
+			options.output_directory = argv[++i];
+		else if (arg == "--suffix" && has_value)
+			options.output_suffix = argv[++i];
+		else if (arg == "--threads" && has_value)
+		{
+			char* end = nullptr;
+			const char* value = argv[++i];
+			options.thread_count = static_cast<unsigned>(std::strtoul(value, &end, 10));
+			ok = end != value && *end == '\0';
+		}
+		else if (arg == "--format" && has_value)
+		{
+			std::string keys = argv[++i];
+			ok = keys.size() == 3 && keys[0] != keys[1] && keys[0] != keys[2] && keys[1] != keys[2];
+			if (ok)
+				fmt = { keys[0], keys[1], keys[2] };
+		}
+		else if (arg.size() > 1 && arg[0] == '-' && arg[1] == '-')
+			ok = false;
+		else
+			inputs.push_back(arg);
+
+		if (!ok)
+		{
+			usage();
+			return 2;
+		}
+	}
+	if (inputs.empty())
+	{
+		usage();
+		return 2;
+	}
+
+	// Loose files go through one job so they share the thread pool. Each directory is a job of its own.
+	const thug::morse_converter converter(fmt);
+	std::vector<std::string> files;
+	thug::file_job_result total;
+	for (const auto& input : inputs)
+	{
+		std::error_code ec;
+		if (std::filesystem::is_directory(input, ec))
+			add(total, converter.convert_directory(input, options));
+		else
+			files.push_back(input);
+	}
+	if (!files.empty())
+		add(total, converter.convert_files(files, options));
+
+	for (const auto& error : total.errors)
+		std::cerr << error.path << ": " << error.message << "\n";
+	std::fprintf(stderr, "%zu files, %llu bytes in, %llu bytes out, %.3f s, %.1f MB/s, %zu errors\n", total.files,
+		static_cast<unsigned long long>(total.bytes_in), static_cast<unsigned long long>(total.bytes_out), total.seconds, total.throughput() / 1e6,
+		total.errors.size());
+	return total.errors.empty() ? 0 : 1;
+}